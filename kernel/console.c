@@ -14,6 +14,7 @@
 #include "mmu.h"
 #include "proc.h"
 #include "x86.h"
+#include "poll.h"
 
 static void consputc(int);
 
@@ -182,6 +183,7 @@ struct {
 	uint r;  // Read index
 	uint w;  // Write index
 	uint e;  // Edit index
+	struct pollent *pollq;  // processes in poll(), under cons.lock
 } input;
 
 #define C(x)  ((x)-'@')  // Control-x
@@ -219,6 +221,7 @@ consoleintr(int (*getc)(void))
 				if(c == '\n' || c == C('D') || input.e == input.r+INPUT_BUF){
 					input.w = input.e;
 					wakeup(&input.r);
+					pollwakeup(input.pollq);
 				}
 			}
 			break;
@@ -234,10 +237,12 @@ int
 consoleread(struct inode *ip, char *dst, int n)
 {
 	uint target;
-	int c;
+	int c, bad;
+	char ch;
 
 	iunlock(ip);
 	target = n;
+	bad = 0;
 	acquire(&cons.lock);
 	while(n > 0){
 		while(input.r == input.w){
@@ -257,7 +262,13 @@ consoleread(struct inode *ip, char *dst, int n)
 			}
 			break;
 		}
-		*dst++ = c;
+		ch = c;
+		if(ucopy(dst++, &ch, 1) < 0){
+			// dst was unmapped: leave c for the next read.
+			input.r--;
+			bad = 1;
+			break;
+		}
 		--n;
 		if(c == '\n')
 			break;
@@ -265,6 +276,8 @@ consoleread(struct inode *ip, char *dst, int n)
 	release(&cons.lock);
 	ilock(ip);
 
+	if(bad && n == target)
+		return -1;
 	return target - n;
 }
 
@@ -272,15 +285,36 @@ int
 consolewrite(struct inode *ip, char *buf, int n)
 {
 	int i;
+	char c;
 
 	iunlock(ip);
 	acquire(&cons.lock);
-	for(i = 0; i < n; i++)
-		consputc(buf[i] & 0xff);
+	for(i = 0; i < n; i++){
+		if(ucopy(&c, buf + i, 1) < 0)
+			break;
+		consputc(c & 0xff);
+	}
 	release(&cons.lock);
 	ilock(ip);
 
-	return n;
+	return i > 0 || n == 0 ? i : -1;
+}
+
+// The poll() events of the console, queueing e if it is not 0.
+// Unlike read and write, called without ip locked.
+int
+consolepoll(struct inode *ip, struct pollent *e)
+{
+	int r;
+
+	r = POLLOUT;
+	acquire(&cons.lock);
+	if(input.r != input.w)
+		r |= POLLIN;
+	if(e)
+		pollqadd(&input.pollq, e, &cons.lock);
+	release(&cons.lock);
+	return r;
 }
 
 void
@@ -290,6 +324,7 @@ consoleinit(void)
 
 	devsw[CONSOLE].write = consolewrite;
 	devsw[CONSOLE].read = consoleread;
+	devsw[CONSOLE].poll = consolepoll;
 	cons.locking = 1;
 
 	ioapicenable(IRQ_KBD, 0);
@@ -1,14 +1,20 @@
 struct buf;
 struct context;
+struct cpu;
+struct fdtable;
 struct file;
 struct inode;
 struct pipe;
+struct pollent;
 struct proc;
+struct pstat;
 struct rtcdate;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct timer;
+struct vmspace;
 
 // bio.c
 void            binit(void);
@@ -33,6 +39,19 @@ void            fileinit(void);
 int             fileread(struct file*, char*, int n);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
+int             filesplice(struct file*, struct file*, int n);
+int             filepread(struct file*, char*, int n, uint);
+int             filepwrite(struct file*, char*, int n, uint);
+int             fileseek(struct file*, int, int);
+int             filepoll(struct file*, struct pollent*);
+
+struct fdtable* fdtalloc(void);
+struct fdtable* fdtcopy(struct fdtable*);
+struct fdtable* fdtdup(struct fdtable*);
+void            fdtclose(struct fdtable*);
+int             fdtadd(struct fdtable*, struct file*);
+struct file*    fdtget(struct fdtable*, int);
+int             fdtremove(struct fdtable*, int, struct file*);
 
 // fs.c
 void            readsb(int dev, struct superblock *sb);
@@ -68,6 +87,13 @@ char*           kalloc(void);
 void            kfree(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+char*           kzalloc(void);
+int             kzeroidle(void);
+
+// kmalloc.c
+void*           kmalloc(uint);
+void            kmallocinit(void);
+void            kmfree(void*, uint);
 
 // kbd.c
 void            kbdintr(void);
@@ -79,13 +105,41 @@ extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
 void            lapicstartap(uchar, uint);
+void            lapicipi(int, int);
+uint            lapicstop(void);
+void            lapiconeshot(uint);
+uint            lapicleft(void);
+int             lapictimerpending(void);
+void            lapicperiodic(void);
+extern uint     lapictick;
+extern uint     tscperus;
 void            microdelay(int);
 
 // log.c
 void            initlog(int dev);
 void            log_write(struct buf*);
+void            log_data(struct buf*);
+void            log_free(uint);
 void            begin_op();
 void            end_op();
+void            begin_opn(int);
+void            end_opn(int);
+
+// mmap.c
+void            mmapinit(void);
+int             mmap(uint, int, int, struct file*, uint);
+int             munmap(uint, uint);
+int             mmapaccess(uint, uint, int);
+int             mmapfault(uint, uint);
+int             mmapnew(struct proc*);
+struct vmspace* mmapalloc(void);
+void            mmapfree(struct vmspace*);
+void            mmapswitch(struct proc*, struct vmspace*);
+int             mmapcopy(struct proc*, struct proc*);
+void            mmapshare(struct proc*, struct proc*);
+void            mmapclear(struct proc*);
+void            mmaplock(struct proc*);
+void            mmapunlock(struct proc*);
 
 // mp.c
 extern int      ismp;
@@ -98,13 +152,21 @@ void            picinit(void);
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, char*, int);
-int             pipewrite(struct pipe*, char*, int);
+int             piperead(struct pipe*, char*, int, int);
+int             pipewrite(struct pipe*, char*, int, int);
+int             pipewbegin(struct pipe*, char**, int);
+void            pipewend(struct pipe*, int);
+int             piperbegin(struct pipe*, char**, int, int);
+void            piperend(struct pipe*, int);
+int             pipepoll(struct pipe*, int, struct pollent*);
 
 // proc.c
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
+int             clone(uint, uint, uint);
+int             join(int, uint*);
+int             unshare(struct proc*);
 int             growproc(int);
 int             kill(int);
 struct cpu*     mycpu(void);
@@ -118,7 +180,19 @@ void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
+int             wakeupn(void*, int);
+int             futex(int*, int, int);
+void            pollqadd(struct pollent**, struct pollent*, struct spinlock*);
+void            pollqdel(struct pollent*);
+void            pollwakeup(struct pollent*);
+int             pollsleep(int, uint);
 void            yield(void);
+int             kick(struct cpu*);
+void            proctick(void);
+void            boost(void);
+int             setnice(int, int);
+int             setaffinity(int, int);
+int             procstat(int, struct pstat*);
 
 // swtch.S
 // Ova funkcija nam sluzi da predjemo sa izvrsavanja jednog procesa
@@ -152,17 +226,26 @@ char*           strncpy(char*, const char*, int);
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
-int             argstr(int, char**);
+int             argptrw(int, char**, int);
+int             argstr(int, char*, int);
 int             fetchint(uint, int*);
-int             fetchstr(uint, char**);
+int             fetchstr(uint, char*, int);
+int             useraccess(uint, int, int);
 void            syscall(void);
 
 // timer.c
 void            timerinit(void);
+void            settimer(struct timer*, uint, void*);
+void            canceltimer(struct timer*);
+void            timerexpire(uint, uint);
+uint            timernext(uint);
 
 // trap.c
 void            idtinit(void);
 extern uint     ticks;
+void            clockadvance(uint);
+uint            clocknext(void);
+int             sleeptsc(uint64);
 void            tvinit(void);
 extern struct spinlock tickslock;
 
@@ -171,6 +254,9 @@ void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
 
+// ucopy.S
+int             ucopy(void*, const void*, uint);
+
 // vm.c
 void            seginit(void);
 void            kvmalloc(void);
@@ -178,6 +264,9 @@ pde_t*          setupkvm(void);
 char*           uva2ka(pde_t*, char*);
 int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
+int             shrinkuvm(pde_t*, uint, uint);
+void            tlbflush(void);
+void            tlbshootdown(pde_t*);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
@@ -186,6 +275,8 @@ void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
+int             mappages(pde_t*, void*, uint, uint, int);
+pte_t*          walkpgdir(pde_t*, const void*, int);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -18,6 +18,7 @@ exec(char *path, char **argv)
 	struct inode *ip;
 	struct proghdr ph;
 	pde_t *pgdir, *oldpgdir;
+	struct vmspace *vs;
 	struct proc *curproc = myproc();
 
 	begin_op();
@@ -32,6 +33,7 @@ exec(char *path, char **argv)
 	// Lockuje ga
 	ilock(ip);
 	pgdir = 0;
+	vs = 0;
 
 	// Check ELF header
 	// Ucitamo elf header
@@ -58,6 +60,8 @@ exec(char *path, char **argv)
 			goto bad;
 		if(ph.vaddr + ph.memsz < ph.vaddr)
 			goto bad;
+		if(ph.vaddr + ph.memsz > MMAPBASE - 2*PGSIZE)
+			goto bad;
 		if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
 			goto bad;
 		if(ph.vaddr % PGSIZE != 0)
@@ -103,6 +107,10 @@ exec(char *path, char **argv)
 	if(copyout(pgdir, sp, ustack, (3+argc+1)*4) < 0)
 		goto bad;
 
+	// The new program starts without mappings.
+	if((vs = mmapalloc()) == 0)
+		goto bad;
+
 	// Save program name for debugging.
 	for(last=s=path; *s; s++)
 		if(*s == '/')
@@ -110,16 +118,21 @@ exec(char *path, char **argv)
 	safestrcpy(curproc->name, last, sizeof(curproc->name));
 
 	// Commit to the user image.
+	// The old mappings and page table stay if other threads use them.
+	mmapswitch(curproc, vs);
 	oldpgdir = curproc->pgdir;
 	curproc->pgdir = pgdir;
 	curproc->sz = sz;
 	curproc->tf->eip = elf.entry;  // main
 	curproc->tf->esp = sp;
 	switchuvm(curproc);
-	freevm(oldpgdir); // Brisemo stari adresni prostor
+	if(unshare(curproc))
+		freevm(oldpgdir); // Brisemo stari adresni prostor
 	return 0;
 
 	bad:
+	if(vs)
+		mmapfree(vs);
 	if(pgdir)
 		freevm(pgdir);
 	if(ip){
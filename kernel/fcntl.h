@@ -3,3 +3,17 @@
 #define O_RDWR    0x002
 #define O_CREATE  0x200
 #define O_NOFOLLOW 0x400
+#define O_NONBLOCK 0x800
+
+// fcntl() commands
+#define F_GETFL   3  // get the O_ flags of an fd
+#define F_SETFL   4  // set its O_NONBLOCK flag
+
+// read() and write() on an O_NONBLOCK pipe or device return
+// -EAGAIN instead of waiting for data or room.
+#define EAGAIN   11
+
+// lseek() whence
+#define SEEK_SET  0  // from the start of the file
+#define SEEK_CUR  1  // from the current offset
+#define SEEK_END  2  // from the end of the file
@@ -5,21 +5,206 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "stat.h"
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "fcntl.h"
+#include "poll.h"
 
 struct devsw devsw[NDEV];
+
+// Files come from kmalloc(), up to NFILE of them.
 struct {
-	struct spinlock lock;
-	struct file file[NFILE];
+	struct spinlock lock;  // protects nfile and each file's ref
+	int nfile;
 } ftable;
 
+// Fd tables and their arrays come from kmalloc().
+struct {
+	struct spinlock lock;  // protects ref
+} fdtables;
+
+#define MAPWORDS(n) (((n) + 31) / 32)
+
 void
 fileinit(void)
 {
 	initlock(&ftable.lock, "ftable");
+	initlock(&fdtables.lock, "fdtables");
+}
+
+// Free the arrays of fd table t.
+static void
+fdtfreearrays(struct fdtable *t)
+{
+	kmfree(t->ofile, t->nofile*sizeof(t->ofile[0]));
+	kmfree(t->used, MAPWORDS(t->nofile)*sizeof(t->used[0]));
+}
+
+// Give fd table t arrays for n files, keeping its open files.
+// Returns -1 if out of memory, with t unchanged.
+static int
+fdtresize(struct fdtable *t, int n)
+{
+	struct file **ofile;
+	uint *used;
+
+	if((ofile = kmalloc(n*sizeof(ofile[0]))) == 0)
+		return -1;
+	if((used = kmalloc(MAPWORDS(n)*sizeof(used[0]))) == 0){
+		kmfree(ofile, n*sizeof(ofile[0]));
+		return -1;
+	}
+	if(t->nofile > 0){
+		memmove(ofile, t->ofile, t->nofile*sizeof(ofile[0]));
+		memmove(used, t->used, MAPWORDS(t->nofile)*sizeof(used[0]));
+		fdtfreearrays(t);
+	}
+	t->ofile = ofile;
+	t->used = used;
+	t->nofile = n;
+	return 0;
+}
+
+// Allocate an empty fd table with room for n files.
+static struct fdtable*
+fdtnew(int n)
+{
+	struct fdtable *t;
+
+	if((t = kmalloc(sizeof(*t))) == 0)
+		return 0;
+	if(fdtresize(t, n) < 0){
+		kmfree(t, sizeof(*t));
+		return 0;
+	}
+	initlock(&t->lock, "fdtable");
+	t->ref = 1;
+	return t;
+}
+
+struct fdtable*
+fdtalloc(void)
+{
+	return fdtnew(NOFILE);
+}
+
+// Allocate a copy of fd table t, for fork().
+struct fdtable*
+fdtcopy(struct fdtable *t)
+{
+	struct fdtable *nt;
+	int fd;
+
+	acquire(&t->lock);
+	if((nt = fdtnew(t->nofile)) == 0){
+		release(&t->lock);
+		return 0;
+	}
+	for(fd = 0; fd < t->nofile; fd++)
+		if(t->ofile[fd])
+			nt->ofile[fd] = filedup(t->ofile[fd]);
+	memmove(nt->used, t->used, MAPWORDS(t->nofile)*sizeof(t->used[0]));
+	release(&t->lock);
+	return nt;
+}
+
+// Share fd table t with one more process, for clone().
+struct fdtable*
+fdtdup(struct fdtable *t)
+{
+	acquire(&fdtables.lock);
+	t->ref++;
+	release(&fdtables.lock);
+	return t;
+}
+
+// Drop a reference to fd table t; the last one closes its files.
+void
+fdtclose(struct fdtable *t)
+{
+	int fd;
+
+	acquire(&fdtables.lock);
+	if(t->ref > 1){
+		t->ref--;
+		release(&fdtables.lock);
+		return;
+	}
+	release(&fdtables.lock);
+	for(fd = 0; fd < t->nofile; fd++){
+		if(t->ofile[fd]){
+			fileclose(t->ofile[fd]);
+			t->ofile[fd] = 0;
+		}
+	}
+	fdtfreearrays(t);
+	kmfree(t, sizeof(*t));
+}
+
+// Give f the lowest free fd in table t, growing the table if
+// it is full. Takes over the caller's reference to f.
+// Returns the fd, or -1 if the table cannot grow.
+int
+fdtadd(struct fdtable *t, struct file *f)
+{
+	int i, fd;
+	uint free;
+
+	acquire(&t->lock);
+	for(i = 0; i < MAPWORDS(t->nofile); i++)
+		if((free = ~t->used[i]) != 0)
+			break;
+	if(i < MAPWORDS(t->nofile)){
+		for(fd = i*32; (free & 1) == 0; fd++)
+			free >>= 1;
+	} else
+		fd = t->nofile;
+	if(fd >= t->nofile &&
+	   (fd >= NOFILEMAX || fdtresize(t, 2*t->nofile) < 0)){
+		release(&t->lock);
+		return -1;
+	}
+	t->ofile[fd] = f;
+	t->used[fd/32] |= 1U << (fd%32);
+	release(&t->lock);
+	return fd;
+}
+
+// The file open as fd in table t with a reference taken for
+// the caller, who must fileclose() it; or 0. Files are freed on
+// their last close, so there is no way to look one up without a
+// reference, and it is taken under t->lock so that a close() of
+// fd by another thread cannot free the file first.
+struct file*
+fdtget(struct fdtable *t, int fd)
+{
+	struct file *f;
+
+	f = 0;
+	acquire(&t->lock);
+	if(fd >= 0 && fd < t->nofile && (f = t->ofile[fd]) != 0)
+		filedup(f);
+	release(&t->lock);
+	return f;
+}
+
+// Free fd in table t if file f is still open as fd, which
+// another thread may have closed. Returns 0 if it was.
+int
+fdtremove(struct fdtable *t, int fd, struct file *f)
+{
+	acquire(&t->lock);
+	if(fd < 0 || fd >= t->nofile || t->ofile[fd] != f){
+		release(&t->lock);
+		return -1;
+	}
+	t->ofile[fd] = 0;
+	t->used[fd/32] &= ~(1U << (fd%32));
+	release(&t->lock);
+	return 0;
 }
 
 // Allocate a file structure.
@@ -29,15 +214,14 @@ filealloc(void)
 	struct file *f;
 
 	acquire(&ftable.lock);
-	for(f = ftable.file; f < ftable.file + NFILE; f++){
-		if(f->ref == 0){
-			f->ref = 1;
-			release(&ftable.lock);
-			return f;
-		}
+	if(ftable.nfile >= NFILE || (f = kmalloc(sizeof(*f))) == 0){
+		release(&ftable.lock);
+		return 0;
 	}
+	ftable.nfile++;
+	f->ref = 1;
 	release(&ftable.lock);
-	return 0;
+	return f;
 }
 
 // Increment ref count for file f.
@@ -66,9 +250,9 @@ fileclose(struct file *f)
 		return;
 	}
 	ff = *f;
-	f->ref = 0;
-	f->type = FD_NONE;
+	ftable.nfile--;
 	release(&ftable.lock);
+	kmfree(f, sizeof(*f));
 
 	if(ff.type == FD_PIPE)
 		pipeclose(ff.pipe, ff.writable);
@@ -92,6 +276,31 @@ filestat(struct file *f, struct stat *st)
 	return -1;
 }
 
+// The poll() events of file f, queueing e on what f refers
+// to if it is not 0 and f can become ready later.
+int
+filepoll(struct file *f, struct pollent *e)
+{
+	int (*poll)(struct inode*, struct pollent*);
+	int r;
+
+	if(f->type == FD_PIPE)
+		return pipepoll(f->pipe, f->writable, e);
+	poll = 0;
+	if(f->type == FD_INODE){
+		ilock(f->ip);
+		if(f->ip->type == T_DEV && f->ip->major >= 0 && f->ip->major < NDEV)
+			poll = devsw[f->ip->major].poll;
+		iunlock(f->ip);
+	}
+	r = poll ? poll(f->ip, e) : POLLIN|POLLOUT;
+	if(!f->readable)
+		r &= ~POLLIN;
+	if(!f->writable)
+		r &= ~POLLOUT;
+	return r;
+}
+
 // Read from file f.
 int
 fileread(struct file *f, char *addr, int n)
@@ -101,8 +310,12 @@ fileread(struct file *f, char *addr, int n)
 	if(f->readable == 0)
 		return -1;
 	if(f->type == FD_PIPE)
-		return piperead(f->pipe, addr, n);
+		return piperead(f->pipe, addr, n, f->nonblock);
 	if(f->type == FD_INODE){
+		// Only devices can have to wait; another reader may
+		// still take the input first.
+		if(f->nonblock && !(filepoll(f, 0) & POLLIN))
+			return -EAGAIN;
 		ilock(f->ip);
 		if((r = readi(f->ip, addr, f->off, n)) > 0)
 			f->off += r;
@@ -112,45 +325,176 @@ fileread(struct file *f, char *addr, int n)
 	panic("fileread");
 }
 
+#define NBITMAP (FSSIZE/BPB + 1)  // bitmap blocks on disk
+
+// Most blocks that writing n bytes to a file can put in the log:
+// the data blocks (which usually bypass it, but not if they were
+// freed earlier in the transaction), with 2 blocks of slop for
+// non-aligned writes, an allocation bitmap block for each (but
+// no more than there are), the indirect block and the i-node.
+static int
+writeblocks(int n)
+{
+	int d = n/BSIZE + 2;
+
+	return d + (d < NBITMAP ? d : NBITMAP) + 2;
+}
+
+// Write n bytes from addr to the inode of f at *off,
+// advancing *off, which may be &f->off.
+static int
+filewritei(struct file *f, char *addr, int n, uint *off)
+{
+	int r, nb;
+
+	// write as much at a time as fits in one log
+	// transaction, see writeblocks(); the log must
+	// hold at least MAXOPBLOCKS.
+	// this really belongs lower down, since writei()
+	// might be writing a device like the console.
+	int max = (LOGSIZE-1 - 2 - NBITMAP - 2) * BSIZE;
+	if(writeblocks(max) > LOGSIZE-1)
+		max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+	int i = 0;
+	while(i < n){
+		int n1 = n - i;
+		if(n1 > max)
+			n1 = max;
+
+		nb = writeblocks(n1);
+		begin_opn(nb);
+		ilock(f->ip);
+		if ((r = writei(f->ip, addr + i, *off, n1)) > 0)
+			*off += r;
+		iunlock(f->ip);
+		end_opn(nb);
+
+		if(r < 0)
+			break;
+		i += r;
+		if(r != n1)
+			break;  // addr was unmapped
+	}
+	return i > 0 || n == 0 ? i : -1;
+}
+
 // Write to file f.
 int
 filewrite(struct file *f, char *addr, int n)
 {
-	int r;
-
 	if(f->writable == 0)
 		return -1;
 	if(f->type == FD_PIPE)
-		return pipewrite(f->pipe, addr, n);
+		return pipewrite(f->pipe, addr, n, f->nonblock);
 	if(f->type == FD_INODE){
-		// write a few blocks at a time to avoid exceeding
-		// the maximum log transaction size, including
-		// i-node, indirect block, allocation blocks,
-		// and 2 blocks of slop for non-aligned writes.
-		// this really belongs lower down, since writei()
-		// might be writing a device like the console.
-		int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
-		int i = 0;
-		while(i < n){
-			int n1 = n - i;
-			if(n1 > max)
-				n1 = max;
-
-			begin_op();
-			ilock(f->ip);
-			if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
-				f->off += r;
-			iunlock(f->ip);
-			end_op();
+		if(f->nonblock && !(filepoll(f, 0) & POLLOUT))
+			return -EAGAIN;
+		return filewritei(f, addr, n, &f->off);
+	}
+	panic("filewrite");
+}
 
+// Read from file f at offset off, leaving f->off alone.
+// Pipes have no offsets.
+int
+filepread(struct file *f, char *addr, int n, uint off)
+{
+	int r;
+
+	if(f->readable == 0 || f->type != FD_INODE)
+		return -1;
+	ilock(f->ip);
+	r = readi(f->ip, addr, off, n);
+	iunlock(f->ip);
+	return r;
+}
+
+// Write to file f at offset off, leaving f->off alone.
+int
+filepwrite(struct file *f, char *addr, int n, uint off)
+{
+	if(f->writable == 0 || f->type != FD_INODE)
+		return -1;
+	return filewritei(f, addr, n, &off);
+}
+
+// Set the offset of file f to off, counted as whence says.
+// Returns the new offset, or -1.
+int
+fileseek(struct file *f, int off, int whence)
+{
+	int base;
+
+	if(f->type != FD_INODE)
+		return -1;
+	ilock(f->ip);
+	switch(whence){
+	case SEEK_SET:
+		base = 0;
+		break;
+	case SEEK_CUR:
+		base = f->off;
+		break;
+	case SEEK_END:
+		base = f->ip->size;
+		break;
+	default:
+		iunlock(f->ip);
+		return -1;
+	}
+	if(base + off < 0){
+		iunlock(f->ip);
+		return -1;
+	}
+	f->off = base + off;
+	iunlock(f->ip);
+	return f->off;
+}
+
+
+// Move up to n bytes from file in to file out inside the kernel,
+// without a copy through user memory. One of the two must be a
+// pipe and the other an inode; the data is copied straight between
+// the pipe's buffer and the inode. Returns the number of bytes
+// moved, which is less than n at end of file, or -1.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+	int m, r, total;
+	char *buf;
+
+	if(in->readable == 0 || out->writable == 0 || n < 0)
+		return -1;
+	total = 0;
+	if(in->type == FD_INODE && out->type == FD_PIPE){
+		while(total < n){
+			if((m = pipewbegin(out->pipe, &buf, n - total)) < 0)
+				return total > 0 ? total : -1;
+			ilock(in->ip);
+			if((r = readi(in->ip, buf, in->off, m)) > 0)
+				in->off += r;
+			iunlock(in->ip);
+			pipewend(out->pipe, r > 0 ? r : 0);
 			if(r < 0)
-				break;
-			if(r != n1)
-				panic("short filewrite");
-			i += r;
+				return total > 0 ? total : -1;
+			total += r;
+			if(r < m)
+				break;  // end of file
 		}
-		return i == n ? n : -1;
+		return total;
 	}
-	panic("filewrite");
+	if(in->type == FD_PIPE && out->type == FD_INODE){
+		while(total < n){
+			// Only wait for data if there is none yet, like read().
+			if((m = piperbegin(in->pipe, &buf, n - total, total == 0)) <= 0)
+				return total > 0 || m == 0 ? total : -1;
+			r = filewritei(out, buf, m, &out->off);
+			piperend(in->pipe, r > 0 ? r : 0);
+			if(r != m)
+				return total > 0 ? total : -1;
+			total += r;
+		}
+		return total;
+	}
+	return -1;
 }
-
@@ -3,11 +3,23 @@ struct file {
 	int ref; // reference count
 	char readable;
 	char writable;
+	char nonblock;  // O_NONBLOCK
 	struct pipe *pipe;
 	struct inode *ip;
 	uint off;
 };
 
+// A process's open files, shared by the threads of a clone() group.
+// The table starts with room for NOFILE files and doubles as needed,
+// up to NOFILEMAX.
+struct fdtable {
+	struct spinlock lock;  // protects everything below
+	int ref;               // processes using this table
+	int nofile;            // size of ofile[], a multiple of NOFILE
+	struct file **ofile;
+	uint *used;            // bit fd is set if ofile[fd] is in use
+};
+
 
 // in-memory copy of an inode
 // Za razliku od dinode-a, inode se nalazi u memoriji
@@ -34,6 +46,7 @@ struct inode {
 struct devsw {
 	int (*read)(struct inode*, char*, int);
 	int (*write)(struct inode*, char*, int);
+	int (*poll)(struct inode*, struct pollent*);  // 0: always ready
 };
 
 extern struct devsw devsw[];
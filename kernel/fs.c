@@ -52,9 +52,9 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// Allocate a disk block, zeroed if zero is set.
 static uint
-balloc(uint dev)
+balloc(uint dev, int zero)
 {
 	int b, bi, m;
 	struct buf *bp;
@@ -68,7 +68,8 @@ balloc(uint dev)
 				bp->data[bi/8] |= m;  // Mark block in use.
 				log_write(bp);
 				brelse(bp);
-				bzero(dev, b + bi);
+				if(zero)
+					bzero(dev, b + bi);
 				return b + bi;
 			}
 		}
@@ -92,6 +93,7 @@ bfree(int dev, uint b)
 	bp->data[bi/8] &= ~m;
 	log_write(bp);
 	brelse(bp);
+	log_free(b);
 }
 
 // Inodes.
@@ -368,7 +370,9 @@ iunlockput(struct inode *ip)
 // listed in block ip->addrs[NDIRECT].
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bmap allocates one. Data blocks
+// of regular files are not zeroed: only writei() allocates
+// them, and it fills them itself.
 // 
 // Funkciji prosledjujemo memorijski i node, i broj bloka koji selimo da procitamo
 static uint
@@ -381,7 +385,7 @@ bmap(struct inode *ip, uint bn)
 	if(bn < NDIRECT){
 		if((addr = ip->addrs[bn]) == 0)
 			// Balloc nalazi slobodan blok na disku
-			ip->addrs[bn] = addr = balloc(ip->dev);
+			ip->addrs[bn] = addr = balloc(ip->dev, ip->type != T_FILE);
 		return addr;
 	}
 	// Ako nismo u prvih 12, skidamo 12 sa broja bloka
@@ -391,11 +395,11 @@ bmap(struct inode *ip, uint bn)
 	if(bn < NINDIRECT){
 		// Load indirect block, allocating if necessary.
 		if((addr = ip->addrs[NDIRECT]) == 0)
-			ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+			ip->addrs[NDIRECT] = addr = balloc(ip->dev, 1);
 		bp = bread(ip->dev, addr);
 		a = (uint*)bp->data;
 		if((addr = a[bn]) == 0){
-			a[bn] = addr = balloc(ip->dev);
+			a[bn] = addr = balloc(ip->dev, ip->type != T_FILE);
 			log_write(bp);
 		}
 		brelse(bp);
@@ -470,11 +474,13 @@ stati(struct inode *ip, struct stat *st)
 
 // Read data from inode.
 // Caller must hold ip->lock.
+// dst may be a user address; returns -1 if it is not mapped.
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
 	uint tot, m;
 	struct buf *bp;
+	int r;
 
 	if(ip->type == T_DEV){
 		if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read)
@@ -490,19 +496,24 @@ readi(struct inode *ip, char *dst, uint off, uint n)
 	for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
 		bp = bread(ip->dev, bmap(ip, off/BSIZE));
 		m = min(n - tot, BSIZE - off%BSIZE);
-		memmove(dst, bp->data + off%BSIZE, m);
+		r = ucopy(dst, bp->data + off%BSIZE, m);
 		brelse(bp);
+		if(r < 0)
+			return -1;
 	}
 	return n;
 }
 
 // Write data to inode.
 // Caller must hold ip->lock.
+// src may be a user address; if it stops being mapped, returns
+// how much was written before it, or -1 if nothing was.
 int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
 	uint tot, m;
 	struct buf *bp;
+	int r;
 
 	if(ip->type == T_DEV){
 		if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].write)
@@ -518,16 +529,29 @@ writei(struct inode *ip, char *src, uint off, uint n)
 	for(tot=0; tot<n; tot+=m, off+=m, src+=m){
 		bp = bread(ip->dev, bmap(ip, off/BSIZE));
 		m = min(n - tot, BSIZE - off%BSIZE);
-		memmove(bp->data + off%BSIZE, src, m);
-		log_write(bp);
+		if(ip->type == T_FILE){
+			// Blocks past the end of the file were just
+			// allocated and hold whatever was on disk.
+			if(off - off%BSIZE >= ip->size)
+				memset(bp->data, 0, BSIZE);
+			r = ucopy(bp->data + off%BSIZE, src, m);
+			log_data(bp);
+		} else {
+			r = ucopy(bp->data + off%BSIZE, src, m);
+			log_write(bp);
+		}
 		brelse(bp);
+		// A failed copy may have changed part of the block;
+		// it is written anyway, but not counted.
+		if(r < 0)
+			break;
 	}
 
-	if(n > 0 && off > ip->size){
+	if(tot > 0 && off > ip->size){
 		ip->size = off;
 		iupdate(ip);
 	}
-	return n;
+	return tot > 0 || n == 0 ? tot : -1;
 }
 
 // Directories
@@ -20,7 +20,9 @@ struct run {
 struct {
 	struct spinlock lock;
 	int use_lock;
-	struct run *freelist;
+	struct run *freelist;  // free pages with arbitrary contents
+	struct run *zerolist;  // free pages that are already zeroed
+	int nzero;             // length of zerolist
 } kmem;
 
 // Initialization happens in two phases.
@@ -56,6 +58,11 @@ freerange(void *vstart, void *vend)
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+//
+// The page is not filled with junk: every allocation either
+// overwrites the whole page or asks for a zeroed one with
+// kzalloc(), so touching it here would only double the
+// memory traffic of each page's lifetime.
 void
 kfree(char *v)
 {
@@ -64,9 +71,6 @@ kfree(char *v)
 	if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
 		panic("kfree");
 
-	// Fill with junk to catch dangling refs.
-	memset(v, 1, PGSIZE);
-
 	if(kmem.use_lock)
 		acquire(&kmem.lock);
 	r = (struct run*)v;
@@ -89,8 +93,75 @@ kalloc(void)
 	r = kmem.freelist;
 	if(r)
 		kmem.freelist = r->next;
+	else if((r = kmem.zerolist) != 0){
+		kmem.zerolist = r->next;
+		kmem.nzero--;
+	}
+	if(kmem.use_lock)
+		release(&kmem.lock);
+	return (char*)r;
+}
+
+// Allocate one zeroed 4096-byte page of physical memory.
+// Prefers a page from the pool that idle CPUs keep zeroed
+// (see kzeroidle), and only clears a page itself when
+// that pool is empty.
+// Returns 0 if the memory cannot be allocated.
+char*
+kzalloc(void)
+{
+	struct run *r;
+
+	if(kmem.use_lock)
+		acquire(&kmem.lock);
+	r = kmem.zerolist;
+	if(r){
+		kmem.zerolist = r->next;
+		kmem.nzero--;
+	}
 	if(kmem.use_lock)
 		release(&kmem.lock);
+
+	if(r){
+		r->next = 0;  // the only word not cleared by kzeroidle
+		return (char*)r;
+	}
+	if((r = (struct run*)kalloc()) != 0)
+		memset(r, 0, PGSIZE);
 	return (char*)r;
 }
 
+// Move a few pages from the free list to the zeroed pool.
+// Called by scheduler() on a CPU that has nothing to run.
+// The pages are cleared without holding kmem.lock, so other
+// CPUs can keep allocating meanwhile. Returns the number of
+// pages zeroed; 0 means there is nothing left to do.
+int
+kzeroidle(void)
+{
+	struct run *r;
+	int n;
+
+	if(!kmem.use_lock)
+		return 0;  // kinit2() has not run yet
+
+	for(n = 0; n < NZEROBATCH; n++){
+		acquire(&kmem.lock);
+		if(kmem.nzero >= NZEROPAGES || (r = kmem.freelist) == 0){
+			release(&kmem.lock);
+			break;
+		}
+		kmem.freelist = r->next;
+		release(&kmem.lock);
+
+		memset(r, 0, PGSIZE);
+
+		acquire(&kmem.lock);
+		r->next = kmem.zerolist;
+		kmem.zerolist = r;
+		kmem.nzero++;
+		release(&kmem.lock);
+	}
+	return n;
+}
+
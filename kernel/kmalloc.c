@@ -0,0 +1,88 @@
+// Allocator for kernel objects smaller than a page, such as
+// processes and fd tables, so that their number is limited by
+// memory rather than by fixed-size tables.
+//
+// Sizes are rounded up to a power of two, from KMMIN bytes to half
+// a page. Each size has a free list of objects that is refilled a
+// page at a time from kalloc(); the pages are not given back.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+
+#define KMMIN   16
+#define NKMSIZE 8   // KMMIN << (NKMSIZE-1) is PGSIZE/2
+
+struct kmobj {
+	struct kmobj *next;
+};
+
+struct {
+	struct spinlock lock;
+	struct kmobj *free[NKMSIZE];  // free objects of each size
+} kmcache;
+
+void
+kmallocinit(void)
+{
+	initlock(&kmcache.lock, "kmcache");
+}
+
+// The size class that objects of n bytes come from.
+static int
+kmsize(uint n)
+{
+	int i;
+
+	for(i = 0; i < NKMSIZE; i++)
+		if(n <= (KMMIN << i))
+			return i;
+	panic("kmsize");
+}
+
+// Allocate n zeroed bytes, n at most PGSIZE/2.
+// Returns 0 if the memory cannot be allocated.
+void*
+kmalloc(uint n)
+{
+	struct kmobj *o;
+	char *page;
+	uint off, size;
+	int i;
+
+	i = kmsize(n);
+	size = KMMIN << i;
+	acquire(&kmcache.lock);
+	if(kmcache.free[i] == 0){
+		if((page = kalloc()) == 0){
+			release(&kmcache.lock);
+			return 0;
+		}
+		for(off = 0; off < PGSIZE; off += size){
+			o = (struct kmobj*)(page + off);
+			o->next = kmcache.free[i];
+			kmcache.free[i] = o;
+		}
+	}
+	o = kmcache.free[i];
+	kmcache.free[i] = o->next;
+	release(&kmcache.lock);
+	memset(o, 0, n);
+	return o;
+}
+
+// Free v, an object of n bytes returned by kmalloc(n).
+void
+kmfree(void *v, uint n)
+{
+	struct kmobj *o = v;
+	int i;
+
+	i = kmsize(n);
+	acquire(&kmcache.lock);
+	o->next = kmcache.free[i];
+	kmcache.free[i] = o;
+	release(&kmcache.lock);
+}
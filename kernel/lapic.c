@@ -16,6 +16,7 @@
 #define TPR     (0x0080/4)   // Task Priority
 #define EOI     (0x00B0/4)   // EOI
 #define SVR     (0x00F0/4)   // Spurious Interrupt Vector
+#define IRR     (0x0200/4)   // Interrupt Request, 8 registers of 32 vectors
 	#define ENABLE     0x00000100   // Unit Enable
 #define ESR     (0x0280/4)   // Error Status
 #define ICRLO   (0x0300/4)   // Interrupt Command
@@ -42,6 +43,8 @@
 #define TDCR    (0x03E0/4)   // Timer Divide Configuration
 
 volatile uint *lapic;  // Initialized in mp.c
+uint lapictick;        // Timer counts per clock tick
+uint tscperus;         // Time stamp counter cycles per microsecond
 
 static void
 lapicw(int index, int value)
@@ -50,6 +53,47 @@ lapicw(int index, int value)
 	lapic[ID];  // wait for write to finish, by reading
 }
 
+// The 8253/8254 programmable interval timer, whose channel 2
+// (normally the speaker's) is used to time the LAPIC timer.
+#define PIT_HZ      1193182      // PIT input clock
+#define PIT_CH2     0x42         // Channel 2 data port
+#define PIT_MODE    0x43         // Mode/command port
+#define PIT_GATE    0x61         // Channel 2 gate (bit 0), speaker (bit 1)
+#define PIT_OUT2    0x20         // Channel 2 output (read only)
+#define CALMS       10           // Calibration period in ms
+
+// Count how far the LAPIC timer runs in CALMS milliseconds.
+// Time the TSC along with it, for microdelay() and usleep().
+static uint
+lapiccalibrate(void)
+{
+	uint n;
+	uchar gate;
+	uint64 tsc;
+
+	// Load channel 2 with a one-shot count while its gate is low,
+	// so it does not start yet; keep the speaker off.
+	gate = inb(PIT_GATE) & ~0x03;
+	outb(PIT_GATE, gate);
+	outb(PIT_MODE, 0xB0);  // channel 2, lobyte/hibyte, mode 0
+	n = PIT_HZ * CALMS / 1000;
+	outb(PIT_CH2, n & 0xFF);
+	outb(PIT_CH2, n >> 8);
+
+	// Start both and wait for the PIT to reach 0.
+	lapicw(TDCR, X1);
+	lapicw(TIMER, MASKED);
+	lapicw(TICR, 0xFFFFFFFF);
+	outb(PIT_GATE, gate | 0x01);
+	tsc = rdtsc();
+	while((inb(PIT_GATE) & PIT_OUT2) == 0)
+		;
+	n = 0xFFFFFFFF - lapic[TCCR];
+	tscperus = (uint)(rdtsc() - tsc) / (CALMS * 1000);
+	lapicw(TICR, 0);
+	return n;
+}
+
 void
 lapicinit(void)
 {
@@ -61,11 +105,14 @@ lapicinit(void)
 
 	// The timer repeatedly counts down at bus frequency
 	// from lapic[TICR] and then issues an interrupt.
-	// If xv6 cared more about precise timekeeping,
-	// TICR would be calibrated using an external time source.
+	// The boot CPU measures the bus frequency against the PIT,
+	// and all CPUs then tick HZ times per second.
+	if(lapictick == 0)
+		lapictick = lapiccalibrate() * (1000 / CALMS) / HZ;
+	if(lapictick == 0)
+		lapictick = 10000000;
 	lapicw(TDCR, X1);
-	lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
-	lapicw(TICR, 10000000);
+	lapicperiodic();
 
 	// Disable logical interrupt lines.
 	lapicw(LINT0, MASKED);
@@ -112,11 +159,86 @@ lapiceoi(void)
 		lapicw(EOI, 0);
 }
 
+// Interrupt the CPU with the given APIC ID.
+void
+lapicipi(int apicid, int vector)
+{
+	if(!lapic)
+		return;
+	lapicw(ICRHI, apicid<<24);
+	lapicw(ICRLO, FIXED | ASSERT | vector);
+	while(lapic[ICRLO] & DELIVS)
+		;
+}
+
+// Make the timer tick every lapictick counts.
+void
+lapicperiodic(void)
+{
+	if(!lapic)
+		return;
+	lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
+	lapicw(TICR, lapictick);
+}
+
+// Stop the periodic timer.
+// Return how many counts of the current tick had gone by.
+uint
+lapicstop(void)
+{
+	uint left;
+
+	if(!lapic)
+		return 0;
+	left = lapic[TCCR];
+	lapicw(TICR, 0);
+	if(left == 0 || left > lapictick)
+		return 0;
+	return lapictick - left;
+}
+
+// Interrupt once, after n counts.
+void
+lapiconeshot(uint n)
+{
+	if(!lapic)
+		return;
+	lapicw(TIMER, T_IRQ0 + IRQ_TIMER);
+	lapicw(TICR, n);
+}
+
+// Counts left before a one-shot interrupt; 0 once it fired.
+uint
+lapicleft(void)
+{
+	if(!lapic)
+		return 0;
+	return lapic[TCCR];
+}
+
+// Whether a timer interrupt is waiting to be taken.
+int
+lapictimerpending(void)
+{
+	int v = T_IRQ0 + IRQ_TIMER;
+
+	if(!lapic)
+		return 0;
+	return (lapic[IRR + v/32*4] >> (v%32)) & 1;
+}
+
 // Spin for a given number of microseconds.
-// On real hardware would want to tune this dynamically.
+// Does not wait at all before lapicinit() has calibrated the TSC.
 void
 microdelay(int us)
 {
+	uint64 end;
+
+	if(us <= 0)
+		return;
+	end = rdtsc() + (uint64)us * tscperus;
+	while(rdtsc() < end)
+		;
 }
 
 #define CMOS_PORT    0x70
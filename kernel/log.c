@@ -19,6 +19,10 @@
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
+// begin_op() reserves log space for MAXOPBLOCKS blocks;
+// a call that knows it may write more, or fewer, uses
+// begin_opn()/end_opn() instead, so that big writes need
+// few transactions.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -28,6 +32,14 @@
 //   block C
 //   ...
 // Log appends are synchronous.
+//
+// File data blocks normally skip the log (ordered mode):
+// log_data() writes them in place before the transaction
+// that points to them commits, so after a crash a file
+// never refers to blocks that do not hold its data yet.
+// A block freed in the current transaction may still be
+// part of its old file or directory if we crash, so until
+// the commit it is only written through the log.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -36,14 +48,21 @@ struct logheader {
 	int block[LOGSIZE];
 };
 
+#define NFREED (MAXFILE+1)  // enough to truncate any one file
+
 struct log {
 	struct spinlock lock;
 	int start;
 	int size;
 	int outstanding; // how many FS sys calls are executing.
+	int reserved;    // log blocks reserved by them
+	int waiting;     // how many are waiting for log space
 	int committing;  // in commit(), please wait.
 	int dev;
 	struct logheader lh;
+	int nfreed;      // blocks freed in this transaction
+	int freedlost;   // more than NFREED were freed
+	uint freed[NFREED];
 };
 struct log log;
 
@@ -121,34 +140,59 @@ recover_from_log(void)
 	write_head(); // clear the log
 }
 
-// called at the start of each FS system call.
+// called at the start of each FS system call
+// that writes at most n blocks.
+// An op that has to wait for log space makes later ops wait
+// behind it, so that a steady stream of small ops cannot keep
+// a large one out forever.
 void
-begin_op(void)
+begin_opn(int n)
 {
+	int waited;
+
+	// The header takes one of the log's blocks.
+	if(n > log.size - 1)
+		panic("begin_opn: too big");
 	acquire(&log.lock);
+	waited = 0;
 	while(1){
-		if(log.committing){
+		if(log.committing || (log.waiting > 0 && !waited)){
 			sleep(&log, &log.lock);
-		} else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+		} else if(log.lh.n + log.reserved + n > log.size - 1){
 			// this op might exhaust log space; wait for commit.
+			if(!waited){
+				waited = 1;
+				log.waiting += 1;
+			}
 			sleep(&log, &log.lock);
 		} else {
+			if(waited && --log.waiting == 0)
+				wakeup(&log);
 			log.outstanding += 1;
+			log.reserved += n;
 			release(&log.lock);
 			break;
 		}
 	}
 }
 
-// called at the end of each FS system call.
+void
+begin_op(void)
+{
+	begin_opn(MAXOPBLOCKS);
+}
+
+// called at the end of each FS system call, with the
+// n given to begin_opn().
 // commits if this was the last outstanding operation.
 void
-end_op(void)
+end_opn(int n)
 {
 	int do_commit = 0;
 
 	acquire(&log.lock);
 	log.outstanding -= 1;
+	log.reserved -= n;
 	if(log.committing)
 		panic("log.committing");
 	if(log.outstanding == 0){
@@ -173,6 +217,12 @@ end_op(void)
 	}
 }
 
+void
+end_op(void)
+{
+	end_opn(MAXOPBLOCKS);
+}
+
 // Copy modified blocks from cache to log.
 static void
 write_log(void)
@@ -199,6 +249,9 @@ commit()
 		log.lh.n = 0;
 		write_head();    // Erase the transaction from the log
 	}
+	// Freed blocks are free on disk now.
+	log.nfreed = 0;
+	log.freedlost = 0;
 }
 
 // Caller has modified b->data and is done with the buffer.
@@ -242,3 +295,41 @@ log_write(struct buf *b)
 	release(&log.lock);
 }
 
+// Caller has modified b->data, a data block of a regular file,
+// and is done with the buffer. Write it to its home location
+// now, unless it must go through the log; see the top of the file.
+void
+log_data(struct buf *b)
+{
+	int i, logged;
+
+	if (log.outstanding < 1)
+		panic("log_data outside of trans");
+
+	acquire(&log.lock);
+	logged = log.freedlost;
+	for (i = 0; i < log.lh.n && !logged; i++)
+		if (log.lh.block[i] == b->blockno)
+			logged = 1;
+	for (i = 0; i < log.nfreed && !logged; i++)
+		if (log.freed[i] == b->blockno)
+			logged = 1;
+	release(&log.lock);
+
+	if (logged)
+		log_write(b);
+	else
+		bwrite(b);
+}
+
+// Block b has been freed in the current transaction.
+void
+log_free(uint b)
+{
+	acquire(&log.lock);
+	if (log.nfreed < NFREED)
+		log.freed[log.nfreed++] = b;
+	else
+		log.freedlost = 1;
+	release(&log.lock);
+}
@@ -19,6 +19,7 @@ main(void)
 {
 	kinit1(end, P2V(4*1024*1024)); // phys page allocator
 	kvmalloc();      // kernel page table
+	kmallocinit();   // kernel object allocator
 	mpinit();        // detect other processors
 	lapicinit();     // interrupt controller
 	seginit();       // segment descriptors
@@ -30,6 +31,7 @@ main(void)
 	tvinit();        // trap vectors
 	binit();         // buffer cache
 	fileinit();      // file table
+	mmapinit();      // shared mapped pages
 	ideinit();       // disk
 	startothers();   // start other processors
 	kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
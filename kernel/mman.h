@@ -0,0 +1,11 @@
+// Memory mapping flags for mmap().
+// Both the kernel and user programs use this header file.
+
+#define PROT_READ     0x1   // pages may be read
+#define PROT_WRITE    0x2   // pages may be written
+
+#define MAP_SHARED    0x01  // writes go back to the file and are seen by others
+#define MAP_PRIVATE   0x02  // writes stay private to this process
+#define MAP_ANONYMOUS 0x20  // zero-filled memory, no file (MAP_PRIVATE only)
+
+#define MAP_FAILED    ((void*)-1)
@@ -0,0 +1,655 @@
+//
+// Memory mappings: mmap() and munmap().
+//
+// Mappings live in [MMAPBASE, KERNBASE), above the heap, and are
+// described by the vma[] array of the process's vmspace, which the
+// threads of a clone() group share. No memory is set up by
+// mmap() itself; mmapfault() fills in one page at a time when the
+// process touches it (see the T_PGFLT case in trap.c).
+//
+// Pages of MAP_SHARED file mappings are kept in mcache, keyed by
+// inode and offset, so every process mapping the same part of a
+// file uses the same physical page. A shared page is written back
+// to the file when its last mapping goes away, if any mapping
+// dirtied it. MAP_PRIVATE file mappings map the same cached pages
+// read-only, and copy a page the first time it is written to
+// (see vmacow()). MAP_ANONYMOUS pages are private zeroed pages.
+//
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "stat.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "mman.h"
+
+// PTE bit available to software: the page belongs to mcache.
+#define PTE_MCACHE  0x200
+
+struct mpage {
+	struct inode *ip;  // file the page belongs to
+	uint off;          // page-aligned offset in the file
+	char *mem;         // the physical page
+	int ref;           // number of PTEs mapping it; 0 if the slot is free
+	int dirty;         // written through some mapping
+};
+
+struct {
+	struct spinlock lock;
+	struct mpage page[NMPAGE];
+} mcache;
+
+// A mapped region of a process's address space.
+struct vma {
+	int used;
+	uint start;          // page-aligned
+	uint end;            // page-aligned, exclusive
+	int prot;            // PROT_READ, PROT_WRITE
+	int flags;           // MAP_SHARED or MAP_PRIVATE, MAP_ANONYMOUS
+	struct file *f;      // mapped file, 0 for anonymous memory
+	uint off;            // file offset that start maps
+};
+
+// The mappings of one address space.
+struct vmspace {
+	struct sleeplock lock;  // held while mappings or the heap change
+	int ref;                // processes sharing it
+	struct vma vma[NVMA];
+};
+
+// Vmspaces come from kmalloc().
+struct {
+	struct spinlock lock;  // protects ref
+} vmtable;
+
+void
+mmapinit(void)
+{
+	initlock(&mcache.lock, "mcache");
+	initlock(&vmtable.lock, "vmtable");
+}
+
+// Return the page caching offset off of ip, with its reference
+// count incremented, reading it from the file if nobody has it
+// mapped yet. Returns 0 if out of memory or cache slots.
+static char*
+mpageget(struct inode *ip, uint off)
+{
+	struct mpage *m;
+	char *mem;
+
+	acquire(&mcache.lock);
+	for(m = mcache.page; m < mcache.page + NMPAGE; m++){
+		if(m->ref > 0 && m->ip == ip && m->off == off){
+			m->ref++;
+			release(&mcache.lock);
+			return m->mem;
+		}
+	}
+	release(&mcache.lock);
+
+	// Bytes beyond the end of the file read as zeroes.
+	if((mem = kzalloc()) == 0)
+		return 0;
+	ilock(ip);
+	readi(ip, mem, off, PGSIZE);
+	iunlock(ip);
+
+	acquire(&mcache.lock);
+	// Someone may have cached the page while we were reading it.
+	for(m = mcache.page; m < mcache.page + NMPAGE; m++){
+		if(m->ref > 0 && m->ip == ip && m->off == off){
+			m->ref++;
+			release(&mcache.lock);
+			kfree(mem);
+			return m->mem;
+		}
+	}
+	for(m = mcache.page; m < mcache.page + NMPAGE; m++){
+		if(m->ref == 0){
+			m->ip = ip;
+			m->off = off;
+			m->mem = mem;
+			m->ref = 1;
+			m->dirty = 0;
+			release(&mcache.lock);
+			return mem;
+		}
+	}
+	release(&mcache.lock);
+	kfree(mem);
+	return 0;
+}
+
+// Take another reference to a page that is already cached.
+static void
+mpagedup(struct inode *ip, uint off)
+{
+	struct mpage *m;
+
+	acquire(&mcache.lock);
+	for(m = mcache.page; m < mcache.page + NMPAGE; m++){
+		if(m->ref > 0 && m->ip == ip && m->off == off){
+			m->ref++;
+			release(&mcache.lock);
+			return;
+		}
+	}
+	panic("mpagedup");
+}
+
+// Write a shared page back to its file. Only bytes that are
+// already part of the file are written: a mapping never changes
+// the file's size, so no blocks get allocated, and the page's
+// PGSIZE/BSIZE data blocks fit in a single transaction.
+static void
+mpagewrite(struct inode *ip, uint off, char *mem)
+{
+	uint n;
+
+	begin_op();
+	ilock(ip);
+	if(off < ip->size){
+		n = ip->size - off;
+		if(n > PGSIZE)
+			n = PGSIZE;
+		writei(ip, mem, off, n);
+	}
+	iunlock(ip);
+	end_op();
+}
+
+// Drop a reference to a cached page; dirty says whether the
+// mapping being removed wrote to it. The last reference
+// writes the page back if needed and frees it.
+static void
+mpageput(struct inode *ip, uint off, int dirty)
+{
+	struct mpage *m;
+	char *mem;
+
+	acquire(&mcache.lock);
+	for(m = mcache.page; m < mcache.page + NMPAGE; m++)
+		if(m->ref > 0 && m->ip == ip && m->off == off)
+			break;
+	if(m == mcache.page + NMPAGE)
+		panic("mpageput");
+	m->dirty |= dirty;
+	if(--m->ref > 0){
+		release(&mcache.lock);
+		return;
+	}
+	mem = m->mem;
+	dirty = m->dirty;
+	m->ip = 0;
+	m->mem = 0;
+	release(&mcache.lock);
+
+	if(dirty)
+		mpagewrite(ip, off, mem);
+	kfree(mem);
+}
+
+// Find the mapping of p that contains va.
+static struct vma*
+findvma(struct proc *p, uint va)
+{
+	struct vma *v;
+
+	for(v = p->vm->vma; v < &p->vm->vma[NVMA]; v++)
+		if(v->used && v->start <= va && va < v->end)
+			return v;
+	return 0;
+}
+
+// Page table entry permissions for the pages of v.
+static int
+vmaperm(struct vma *v)
+{
+	if(v->prot & PROT_WRITE)
+		return PTE_U | PTE_W;
+	return PTE_U;
+}
+
+// Allocate and map the page of v at page-aligned address va,
+// for writing if write is set. File pages come from mcache,
+// read-only if the mapping is private. A private mapping gets
+// its own copy right away if it is about to write, or if mcache
+// is full.
+static int
+vmafill(struct proc *p, struct vma *v, uint va, int write)
+{
+	char *mem;
+	uint off;
+	int perm;
+
+	off = v->off + (va - v->start);
+	if(v->f && ((v->flags & MAP_SHARED) || !write)){
+		if((mem = mpageget(v->f->ip, off)) != 0){
+			perm = (v->flags & MAP_SHARED) ? vmaperm(v) : PTE_U;
+			if(mappages(p->pgdir, (char*)va, PGSIZE, V2P(mem),
+			            perm | PTE_MCACHE) < 0){
+				mpageput(v->f->ip, off, 0);
+				return -1;
+			}
+			return 0;
+		}
+		if(v->flags & MAP_SHARED)
+			return -1;
+	}
+
+	if((mem = kzalloc()) == 0)
+		return -1;
+	if(v->f){
+		ilock(v->f->ip);
+		readi(v->f->ip, mem, off, PGSIZE);
+		iunlock(v->f->ip);
+	}
+	if(mappages(p->pgdir, (char*)va, PGSIZE, V2P(mem), vmaperm(v)) < 0){
+		kfree(mem);
+		return -1;
+	}
+	return 0;
+}
+
+// Remove the pages of v in [start, end) from p's page table.
+// Threads of p may be using it on other CPUs, so the pages are
+// only let go of once tlbshootdown() has flushed their TLBs.
+static void
+vmaunmap(struct proc *p, struct vma *v, uint start, uint end)
+{
+	uint a;
+	pte_t *pte;
+
+	for(a = start; a < end; a += PGSIZE){
+		pte = walkpgdir(p->pgdir, (char*)a, 0);
+		if(pte != 0)
+			*pte &= ~PTE_P;  // keep the address and PTE_D
+	}
+	tlbshootdown(p->pgdir);
+	for(a = start; a < end; a += PGSIZE){
+		pte = walkpgdir(p->pgdir, (char*)a, 0);
+		if(pte == 0 || PTE_ADDR(*pte) == 0)
+			continue;
+		if(*pte & PTE_MCACHE)
+			mpageput(v->f->ip, v->off + (a - v->start), (*pte & PTE_D) != 0);
+		else
+			kfree(P2V(PTE_ADDR(*pte)));
+		*pte = 0;
+	}
+}
+
+// The private mapping v is writing to the cached page that
+// *pte maps read-only at va: give p a copy of it instead.
+// Other threads may still have the old PTE in their TLBs, so
+// the cached page is let go of only after tlbshootdown().
+static int
+vmacow(struct proc *p, struct vma *v, uint va, pte_t *pte)
+{
+	char *mem;
+
+	if((mem = kalloc()) == 0)
+		return -1;
+	memmove(mem, P2V(PTE_ADDR(*pte)), PGSIZE);
+	*pte = V2P(mem) | PTE_P | vmaperm(v);
+	tlbshootdown(p->pgdir);
+	mpageput(v->f->ip, v->off + (va - v->start), 0);
+	return 0;
+}
+
+static void
+vmafree(struct vma *v)
+{
+	if(v->f)
+		fileclose(v->f);
+	memset(v, 0, sizeof(*v));
+}
+
+// Handle a page fault at va taken by the current process in
+// user mode. Returns 0 if the faulting page was filled in, or
+// copied for a write to a private mapping, -1 if the access is
+// not allowed. Call with interrupts enabled.
+int
+mmapfault(uint va, uint err)
+{
+	struct proc *p = myproc();
+	struct vma *v;
+	pte_t *pte;
+	int r;
+
+	r = -1;
+	acquiresleep(&p->vm->lock);
+	if((v = findvma(p, va)) == 0)
+		goto out;
+	if((err & FEC_WR) && !(v->prot & PROT_WRITE))
+		goto out;
+	// Another thread may have filled the page in meanwhile.
+	pte = walkpgdir(p->pgdir, (char*)va, 0);
+	if(pte != 0 && (*pte & PTE_P)){
+		if((err & FEC_WR) && !(*pte & PTE_W))
+			r = vmacow(p, v, PGROUNDDOWN(va), pte);
+		else
+			r = 0;
+	} else
+		r = vmafill(p, v, PGROUNDDOWN(va), (err & FEC_WR) != 0);
+out:
+	releasesleep(&p->vm->lock);
+	return r;
+}
+
+// Check that the current process may access [va, va+n) in its
+// mapped region, for writing if write is set, and fill in any
+// missing pages. Used by argptr() so that system calls never
+// take page faults on mapped memory.
+int
+mmapaccess(uint va, uint n, int write)
+{
+	struct proc *p = myproc();
+	struct vma *v;
+	pte_t *pte;
+	uint a;
+	int r;
+
+	if(n == 0 || va + n < va)
+		return -1;
+	r = -1;
+	acquiresleep(&p->vm->lock);
+	if((v = findvma(p, va)) == 0)
+		goto out;
+	if(va + n > v->end || (write && !(v->prot & PROT_WRITE)))
+		goto out;
+	for(a = PGROUNDDOWN(va); a < va + n; a += PGSIZE){
+		pte = walkpgdir(p->pgdir, (char*)a, 0);
+		if(pte != 0 && (*pte & PTE_P)){
+			if(write && !(*pte & PTE_W) && vmacow(p, v, a, pte) < 0)
+				goto out;
+			continue;
+		}
+		if(vmafill(p, v, a, write) < 0)
+			goto out;
+	}
+	r = 0;
+out:
+	releasesleep(&p->vm->lock);
+	return r;
+}
+
+// Create a mapping of len bytes in the current process. Maps f
+// from offset off, or zeroed memory if flags has MAP_ANONYMOUS.
+// Returns the address of the mapping, or -1.
+int
+mmap(uint len, int prot, int flags, struct file *f, uint off)
+{
+	struct proc *p = myproc();
+	struct vmspace *vs = p->vm;
+	struct vma *v, *u;
+	uint start;
+
+	if(len == 0 || off % PGSIZE != 0)
+		return -1;
+	if(((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0))
+		return -1;
+	if(flags & MAP_ANONYMOUS){
+		if(flags & MAP_SHARED)
+			return -1;
+		f = 0;
+		off = 0;
+	} else {
+		if(f == 0 || f->type != FD_INODE || f->ip->type != T_FILE)
+			return -1;
+		if(!f->readable)
+			return -1;
+		if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+			return -1;
+	}
+	len = PGROUNDUP(len);
+	if(len == 0)  // wrapped
+		return -1;
+
+	acquiresleep(&vs->lock);
+	for(v = vs->vma; v < &vs->vma[NVMA]; v++)
+		if(!v->used)
+			break;
+	if(v == &vs->vma[NVMA])
+		goto bad;
+
+	// First fit: lowest address above MMAPBASE that is free.
+	start = MMAPBASE;
+again:
+	for(u = vs->vma; u < &vs->vma[NVMA]; u++){
+		if(u->used && start < u->end && u->start < start + len){
+			start = u->end;
+			goto again;
+		}
+	}
+	if(start + len > KERNBASE || start + len < start)
+		goto bad;
+
+	v->used = 1;
+	v->start = start;
+	v->end = start + len;
+	v->prot = prot;
+	v->flags = flags;
+	v->f = f ? filedup(f) : 0;
+	v->off = off;
+	releasesleep(&vs->lock);
+	return start;
+
+bad:
+	releasesleep(&vs->lock);
+	return -1;
+}
+
+// Remove the mappings of the current process in [addr, addr+len).
+// Mappings that only partly overlap the range are trimmed or split.
+int
+munmap(uint addr, uint len)
+{
+	struct proc *p = myproc();
+	struct vmspace *vs = p->vm;
+	struct vma *v, *nv;
+	uint end, s, e;
+
+	if(addr % PGSIZE != 0 || len == 0)
+		return -1;
+	len = PGROUNDUP(len);
+	end = addr + len;
+	if(len == 0 || end < addr || end > KERNBASE)
+		return -1;
+
+	acquiresleep(&vs->lock);
+	// Splitting a mapping needs a free slot; find it up front
+	// so that nothing has been unmapped if there is none.
+	nv = 0;
+	for(v = vs->vma; v < &vs->vma[NVMA]; v++){
+		if(v->used && v->start < addr && end < v->end){
+			for(nv = vs->vma; nv < &vs->vma[NVMA]; nv++)
+				if(!nv->used)
+					break;
+			if(nv == &vs->vma[NVMA]){
+				releasesleep(&vs->lock);
+				return -1;
+			}
+		}
+	}
+
+	for(v = vs->vma; v < &vs->vma[NVMA]; v++){
+		if(!v->used || end <= v->start || v->end <= addr)
+			continue;
+		s = addr > v->start ? addr : v->start;
+		e = end < v->end ? end : v->end;
+		vmaunmap(p, v, s, e);
+		if(s == v->start && e == v->end)
+			vmafree(v);
+		else if(s == v->start){
+			v->off += e - v->start;
+			v->start = e;
+		} else if(e == v->end)
+			v->end = s;
+		else {
+			*nv = *v;
+			nv->start = e;
+			nv->off = v->off + (e - v->start);
+			if(nv->f)
+				filedup(nv->f);
+			v->end = s;
+		}
+	}
+	releasesleep(&vs->lock);
+	return 0;
+}
+
+// Allocate an empty vmspace.
+static struct vmspace*
+vmsalloc(void)
+{
+	struct vmspace *vs;
+
+	if((vs = kmalloc(sizeof(*vs))) == 0)
+		return 0;
+	initsleeplock(&vs->lock, "vmspace");
+	vs->ref = 1;
+	return vs;
+}
+
+// Give p a new address space without mappings, for userinit().
+int
+mmapnew(struct proc *p)
+{
+	if((p->vm = vmsalloc()) == 0)
+		return -1;
+	return 0;
+}
+
+// Allocate an address space without mappings, for exec() to
+// switch to once it can no longer fail. Returns 0 if out of
+// memory.
+struct vmspace*
+mmapalloc(void)
+{
+	return vmsalloc();
+}
+
+// Free vs, from mmapalloc(), if exec() fails before using it.
+void
+mmapfree(struct vmspace *vs)
+{
+	kmfree(vs, sizeof(*vs));
+}
+
+// Drop p's mappings, as mmapclear() does, and give it vs instead.
+void
+mmapswitch(struct proc *p, struct vmspace *vs)
+{
+	mmapclear(p);
+	p->vm = vs;
+}
+
+// Give np, a fork() child of p, copies of p's mappings:
+// private pages are copied, cached ones stay shared.
+int
+mmapcopy(struct proc *p, struct proc *np)
+{
+	struct vma *v, *nv;
+	pte_t *pte;
+	uint a, off;
+	char *mem;
+	int r;
+
+	if((np->vm = vmsalloc()) == 0)
+		return -1;
+	r = -1;
+	acquiresleep(&p->vm->lock);
+	for(v = p->vm->vma, nv = np->vm->vma; v < &p->vm->vma[NVMA]; v++, nv++){
+		if(!v->used)
+			continue;
+		*nv = *v;
+		if(nv->f)
+			filedup(nv->f);
+		for(a = v->start; a < v->end; a += PGSIZE){
+			pte = walkpgdir(p->pgdir, (char*)a, 0);
+			if(pte == 0 || (*pte & PTE_P) == 0)
+				continue;
+			if(*pte & PTE_MCACHE){
+				off = v->off + (a - v->start);
+				mpagedup(v->f->ip, off);
+				if(mappages(np->pgdir, (char*)a, PGSIZE, PTE_ADDR(*pte),
+				            PTE_FLAGS(*pte) & (PTE_U|PTE_W|PTE_MCACHE)) < 0){
+					mpageput(v->f->ip, off, 0);
+					goto out;
+				}
+			} else {
+				if((mem = kalloc()) == 0)
+					goto out;
+				memmove(mem, P2V(PTE_ADDR(*pte)), PGSIZE);
+				if(mappages(np->pgdir, (char*)a, PGSIZE,
+				            V2P(mem), vmaperm(v)) < 0){
+					kfree(mem);
+					goto out;
+				}
+			}
+		}
+	}
+	r = 0;
+out:
+	releasesleep(&p->vm->lock);
+	return r;
+}
+
+// Let np, a clone() child of p, share p's mappings.
+void
+mmapshare(struct proc *p, struct proc *np)
+{
+	acquire(&vmtable.lock);
+	p->vm->ref++;
+	release(&vmtable.lock);
+	np->vm = p->vm;
+}
+
+// Drop p's reference to its mappings. The last process to go
+// removes them all, writing back shared pages.
+// Called by exit() and exec(), and by fork() on failure.
+void
+mmapclear(struct proc *p)
+{
+	struct vmspace *vs = p->vm;
+	struct vma *v;
+
+	if(vs == 0)
+		return;
+	p->vm = 0;
+	acquire(&vmtable.lock);
+	if(vs->ref > 1){
+		vs->ref--;
+		release(&vmtable.lock);
+		return;
+	}
+	release(&vmtable.lock);
+	for(v = vs->vma; v < &vs->vma[NVMA]; v++){
+		if(!v->used)
+			continue;
+		vmaunmap(p, v, v->start, v->end);
+		vmafree(v);
+	}
+	kmfree(vs, sizeof(*vs));
+}
+
+// Serialize changes to p's address space outside the mapped
+// region, for growproc().
+void
+mmaplock(struct proc *p)
+{
+	acquiresleep(&p->vm->lock);
+}
+
+void
+mmapunlock(struct proc *p)
+{
+	releasesleep(&p->vm->lock);
+}
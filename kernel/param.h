@@ -1,14 +1,25 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC      1024  // maximum number of processes
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
-#define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
+#define NOFILE       16  // fd table size a process starts with
+#define NOFILEMAX   512  // maximum open files per process
+#define NFILE      4096  // maximum open files per system
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define MAXPATH     128  // maximum file path name
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define LOGSIZE      120  // blocks in on-disk log; its header must fit in a block
+#define NBUF         (LOGSIZE+MAXOPBLOCKS*3)  // size of disk block cache
+#define FSSIZE       2000  // size of file system in blocks
+#define HZ          100  // timer interrupts (ticks) per second
+#define TICKLESS      1  // stop the timer on idle CPUs
+#define NPRIO         4  // scheduler priority levels
+#define BOOSTTICKS   HZ  // ticks between priority boosts
+#define NZEROPAGES   1024  // max free pages kept pre-zeroed by idle CPUs
+#define NVMA         16  // memory mappings per process
+#define NMPAGE      256  // shared file pages mapped system-wide
+#define NZEROBATCH    8  // pages an idle CPU zeroes before rescanning
+#define PIPEPAGES     4  // max pages in a pipe buffer, a power of 2
 
@@ -7,18 +7,63 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "poll.h"
+#include "fcntl.h"
 
-#define PIPESIZE 512
+#define min(a, b) ((a) < (b) ? (a) : (b))
 
+// The buffer starts as one page and doubles, up to PIPEPAGES
+// pages, when a writer has found it full. It only grows while
+// empty, so that no data has to move; a power-of-2 size keeps
+// the byte counters valid across their wrap-around.
 struct pipe {
 	struct spinlock lock;
-	char data[PIPESIZE];
+	char *data[PIPEPAGES];  // buffer pages, the first size/PGSIZE in use
+	uint size;      // buffer size in bytes
 	uint nread;     // number of bytes read
 	uint nwrite;    // number of bytes written
 	int readopen;   // read fd is still open
 	int writeopen;  // write fd is still open
+	int nreader;    // readers sleeping on an empty pipe
+	int nwriter;    // writers sleeping on a full pipe
+	int full;       // a writer found the pipe full: grow it
+	int wbusy;      // a splice is filling the buffer without the lock
+	int rbusy;      // a splice is draining the buffer without the lock
+	struct pollent *pollq;  // processes in poll()
 };
 
+// Free p and its buffer.
+static void
+pipefree(struct pipe *p)
+{
+	int i;
+
+	for(i = 0; i < PIPEPAGES && p->data[i]; i++)
+		kfree(p->data[i]);
+	kmfree(p, sizeof(*p));
+}
+
+// Double the buffer of empty pipe p, if memory allows.
+static void
+pipegrow(struct pipe *p)
+{
+	int i, n;
+
+	p->full = 0;
+	n = p->size / PGSIZE;
+	for(i = n; i < 2*n; i++)
+		if((p->data[i] = kalloc()) == 0)
+			break;
+	if(i < 2*n){
+		while(i > n){
+			kfree(p->data[--i]);
+			p->data[i] = 0;
+		}
+		return;
+	}
+	p->size *= 2;
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,8 +73,11 @@ pipealloc(struct file **f0, struct file **f1)
 	*f0 = *f1 = 0;
 	if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
 		goto bad;
-	if((p = (struct pipe*)kalloc()) == 0)
+	if((p = kmalloc(sizeof(*p))) == 0)
 		goto bad;
+	if((p->data[0] = kalloc()) == 0)
+		goto bad;
+	p->size = PGSIZE;
 	p->readopen = 1;
 	p->writeopen = 1;
 	p->nwrite = 0;
@@ -47,7 +95,7 @@ pipealloc(struct file **f0, struct file **f1)
 
 	bad:
 	if(p)
-		kfree((char*)p);
+		pipefree(p);
 	if(*f0)
 		fileclose(*f0);
 	if(*f1)
@@ -66,54 +114,237 @@ pipeclose(struct pipe *p, int writable)
 		p->readopen = 0;
 		wakeup(&p->nwrite);
 	}
+	pollwakeup(p->pollq);
 	if(p->readopen == 0 && p->writeopen == 0){
 		release(&p->lock);
-		kfree((char*)p);
+		pipefree(p);
 	} else
 		release(&p->lock);
 }
 
+// Wait until p has room and no splice is filling it.
+// Returns -1 if nobody will read the data, or -EAGAIN if
+// nonblock is set and it would have to wait.
+static int
+pipewwait(struct pipe *p, int nonblock)
+{
+	while(p->wbusy || p->nwrite == p->nread + p->size){  //DOC: pipewrite-full
+		if(p->readopen == 0 || myproc()->killed)
+			return -1;
+		if(!p->wbusy && p->size < PIPEPAGES*PGSIZE)
+			p->full = 1;
+		if(nonblock)
+			return -EAGAIN;
+		if(p->nreader)
+			wakeup(&p->nread);
+		pollwakeup(p->pollq);
+		p->nwriter++;
+		sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
+		p->nwriter--;
+	}
+	if(p->full && p->nread == p->nwrite)
+		pipegrow(p);
+	return 0;
+}
+
+// Wait until p has data, or no writer, and no splice is draining
+// it. If block is 0, only wait for the splice.
+// Returns -1 if the process was killed.
+static int
+piperwait(struct pipe *p, int block)
+{
+	while(p->rbusy || (block && p->nread == p->nwrite && p->writeopen)){  //DOC: pipe-empty
+		if(myproc()->killed)
+			return -1;
+		p->nreader++;
+		sleep(&p->nread, &p->lock); //DOC: piperead-sleep
+		p->nreader--;
+	}
+	return 0;
+}
+
+// Data is copied a contiguous run at a time, and sleepers are
+// only woken if there are any, once per call or when the pipe
+// fills up. If nonblock is set, writes what fits, or returns
+// -EAGAIN if nothing does. Stops early if addr stops being
+// mapped.
 int
-pipewrite(struct pipe *p, char *addr, int n)
+pipewrite(struct pipe *p, char *addr, int n, int nonblock)
 {
-	int i;
+	int i, m, r;
+	uint off;
 
 	acquire(&p->lock);
-	for(i = 0; i < n; i++){
-		while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
-			if(p->readopen == 0 || myproc()->killed){
-				release(&p->lock);
-				return -1;
-			}
-			wakeup(&p->nread);
-			sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
+	for(i = 0; i < n; i += m){
+		if((r = pipewwait(p, nonblock)) < 0){
+			if(r == -EAGAIN && i > 0)
+				break;
+			release(&p->lock);
+			return r;
 		}
-		p->data[p->nwrite++ % PIPESIZE] = addr[i];
+		off = p->nwrite % p->size;
+		m = min(n - i, p->size - (p->nwrite - p->nread));
+		m = min(m, PGSIZE - off % PGSIZE);
+		if(ucopy(p->data[off / PGSIZE] + off % PGSIZE, addr + i, m) < 0){
+			if(i > 0)
+				break;
+			release(&p->lock);
+			return -1;
+		}
+		p->nwrite += m;
 	}
-	wakeup(&p->nread);  //DOC: pipewrite-wakeup1
+	if(p->nreader)
+		wakeup(&p->nread);  //DOC: pipewrite-wakeup1
+	pollwakeup(p->pollq);
 	release(&p->lock);
-	return n;
+	return i;
 }
 
+// If nonblock is set, returns -EAGAIN instead of waiting.
+// Data that cannot be copied to addr stays in the pipe.
 int
-piperead(struct pipe *p, char *addr, int n)
+piperead(struct pipe *p, char *addr, int n, int nonblock)
 {
-	int i;
+	int i, m;
+	uint off;
 
 	acquire(&p->lock);
-	while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
-		if(myproc()->killed){
+	if(nonblock && (p->rbusy || (p->nread == p->nwrite && p->writeopen))){
+		release(&p->lock);
+		return -EAGAIN;
+	}
+	if(piperwait(p, 1) < 0){
+		release(&p->lock);
+		return -1;
+	}
+	for(i = 0; i < n && p->nread != p->nwrite; i += m){  //DOC: piperead-copy
+		off = p->nread % p->size;
+		m = min(n - i, p->nwrite - p->nread);
+		m = min(m, PGSIZE - off % PGSIZE);
+		if(ucopy(addr + i, p->data[off / PGSIZE] + off % PGSIZE, m) < 0){
+			if(i > 0)
+				break;
 			release(&p->lock);
 			return -1;
 		}
-		sleep(&p->nread, &p->lock); //DOC: piperead-sleep
+		p->nread += m;
 	}
-	for(i = 0; i < n; i++){  //DOC: piperead-copy
-		if(p->nread == p->nwrite)
-			break;
-		addr[i] = p->data[p->nread++ % PIPESIZE];
-	}
-	wakeup(&p->nwrite);  //DOC: piperead-wakeup
+	if(p->nwriter && i > 0)
+		wakeup(&p->nwrite);  //DOC: piperead-wakeup
+	if(i > 0)
+		pollwakeup(p->pollq);
 	release(&p->lock);
 	return i;
 }
+
+// splice() moves data between a pipe's buffer and a file
+// without the pipe lock, which it cannot hold while doing disk
+// I/O. pipewbegin() hands out free space at the tail of the
+// buffer and pipewend() adds what was put there; piperbegin()
+// and piperend() do the same for data at the head. Other
+// writers, or readers, wait in between.
+
+// Wait for room in p and set *dst to up to n bytes of contiguous
+// free space. Returns its size, or -1 if nobody will read it.
+int
+pipewbegin(struct pipe *p, char **dst, int n)
+{
+	uint off;
+	int m;
+
+	acquire(&p->lock);
+	if(pipewwait(p, 0) < 0){
+		release(&p->lock);
+		return -1;
+	}
+	off = p->nwrite % p->size;
+	m = min(n, p->size - (p->nwrite - p->nread));
+	m = min(m, PGSIZE - off % PGSIZE);
+	*dst = p->data[off / PGSIZE] + off % PGSIZE;
+	p->wbusy = 1;
+	release(&p->lock);
+	return m;
+}
+
+// Finish a pipewbegin() that put m bytes into the buffer.
+void
+pipewend(struct pipe *p, int m)
+{
+	acquire(&p->lock);
+	p->nwrite += m;
+	p->wbusy = 0;
+	if(p->nwriter)
+		wakeup(&p->nwrite);
+	if(p->nreader && m > 0)
+		wakeup(&p->nread);
+	pollwakeup(p->pollq);
+	release(&p->lock);
+}
+
+// Set *src to up to n bytes of contiguous data at the head of p,
+// waiting for some if block is set. Returns their size, 0 at end
+// of file or if p is empty and block is 0, or -1 if killed.
+int
+piperbegin(struct pipe *p, char **src, int n, int block)
+{
+	uint off;
+	int m;
+
+	acquire(&p->lock);
+	if(piperwait(p, block) < 0){
+		release(&p->lock);
+		return -1;
+	}
+	if(p->nread == p->nwrite){
+		release(&p->lock);
+		return 0;
+	}
+	off = p->nread % p->size;
+	m = min(n, p->nwrite - p->nread);
+	m = min(m, PGSIZE - off % PGSIZE);
+	*src = p->data[off / PGSIZE] + off % PGSIZE;
+	p->rbusy = 1;
+	release(&p->lock);
+	return m;
+}
+
+// Finish a piperbegin() that took m bytes out of the buffer.
+void
+piperend(struct pipe *p, int m)
+{
+	acquire(&p->lock);
+	p->nread += m;
+	p->rbusy = 0;
+	if(p->nreader)
+		wakeup(&p->nread);
+	if(p->nwriter && m > 0)
+		wakeup(&p->nwrite);
+	pollwakeup(p->pollq);
+	release(&p->lock);
+}
+
+// The poll() events of the read or write end of p, queueing
+// e on p if it is not 0.
+int
+pipepoll(struct pipe *p, int writable, struct pollent *e)
+{
+	int r;
+
+	r = 0;
+	acquire(&p->lock);
+	if(writable){
+		if(!p->wbusy && p->nwrite - p->nread < p->size)
+			r |= POLLOUT;
+		if(p->readopen == 0)
+			r |= POLLERR;
+	} else {
+		if(!p->rbusy && p->nread != p->nwrite)
+			r |= POLLIN;
+		if(p->writeopen == 0)
+			r |= POLLHUP;
+	}
+	if(e)
+		pollqadd(&p->pollq, e, &p->lock);
+	release(&p->lock);
+	return r;
+}
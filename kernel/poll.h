@@ -0,0 +1,12 @@
+// An fd to wait on with poll().
+struct pollfd {
+	int fd;         // ignored if negative
+	short events;   // events of interest
+	short revents;  // events that occurred
+};
+
+#define POLLIN    0x001  // there is data to read
+#define POLLOUT   0x004  // writing will not block
+#define POLLERR   0x008  // nobody will read what is written
+#define POLLHUP   0x010  // no writer is left
+#define POLLNVAL  0x020  // fd is not open
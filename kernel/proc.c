@@ -6,24 +6,321 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "traps.h"
+#include "futex.h"
+#include "pstat.h"
 
+// Processes come from kmalloc() as needed, up to NPROC of them,
+// and are kept for reuse once they exit.
 struct {
 	struct spinlock lock;
-	struct proc proc[NPROC];
+	struct proc *all;            // every process ever allocated
+	int nproc;                   // length of all
+	struct proc *free;           // UNUSED entries, linked by pidnext
 } ptable;
 
+// Processes are found by pid through a hash table, and each
+// process keeps a list of its children, so that neither kill()
+// nor wait() and exit() need to scan the whole table.
+// Protected by ptable.lock.
+#define NPIDHASH 256
+#define PIDHASH(pid) ((uint)(pid) % NPIDHASH)
+
+static struct proc *pidhash[NPIDHASH];
+
+// Each CPU has a queue of the RUNNABLE processes it is to run,
+// so the scheduler neither scans ptable nor needs ptable.lock to
+// find out that there is nothing to do. Processes are queued under
+// ptable.lock (lock order: ptable.lock, then runq lock) whenever
+// they become RUNNABLE; a CPU whose queue is empty steals from the
+// others. A process taken off a queue stays RUNNABLE and belongs
+// to the taking CPU until it is run.
+//
+// The queue is a multi-level feedback queue: one FIFO per priority
+// level, level 0 first. A process at level l runs for up to 1<<l
+// ticks before it is moved down a level (proctick), so processes
+// that mostly sleep, like sh, stay above the CPU hogs. Every
+// BOOSTTICKS ticks everything goes back to its top level (boost),
+// so that hogs cannot starve. nice() lowers a process's top level.
+//
+// A process goes back to the queue of the CPU it last ran on, whose
+// cache may still hold its data, and only moves when another CPU
+// has nothing else to do. affinity() restricts the CPUs a process
+// may run on at all; queues may hold processes that their CPU is
+// not allowed to run, until they are stolen.
+struct runq {
+	struct spinlock lock;
+	struct {
+		struct proc *head;
+		struct proc *tail;
+	} level[NPRIO];
+	int n;                       // Number of queued processes
+} runq[NCPU];
+
+// Sleeping processes are kept in a hash table keyed by wait
+// channel, so that wakeup() only looks at processes that may be
+// sleeping on its channel. Protected by ptable.lock.
+#define NSLEEPQ 64
+#define SLEEPQ(chan) (((uint)(chan) * 2654435761U) >> 26)  // top 6 bits
+
+static struct proc *sleepq[NSLEEPQ];
+
+// May p run on CPU id?
+#define CANRUN(p, id) ((p)->affinity & (1 << (id)))
+
 static struct proc *initproc;
 
 int nextpid = 1;
 extern void forkret(void);
 extern void trapret(void);
 
+// Serializes futex waits against wakes, so that a wake between
+// checking the word and going to sleep cannot get lost.
+static struct spinlock futexlock;
+
 static void wakeup1(void *chan);
 
 void
 pinit(void)
 {
+	int i;
+
 	initlock(&ptable.lock, "ptable");
+	initlock(&futexlock, "futex");
+	for(i = 0; i < NCPU; i++)
+		initlock(&runq[i].lock, "runq");
+}
+
+// Append p to rq at its priority level.
+// The runq lock must be held.
+static void
+runqput(struct runq *rq, struct proc *p)
+{
+	p->rqnext = 0;
+	if(rq->level[p->prio].tail)
+		rq->level[p->prio].tail->rqnext = p;
+	else
+		rq->level[p->prio].head = p;
+	rq->level[p->prio].tail = p;
+	rq->n++;
+}
+
+// Wake CPU c if it is halted in idle().
+// Returns 1 if it was.
+int
+kick(struct cpu *c)
+{
+	if(c == mycpu() || xchg(&c->idle, 0) == 0)
+		return 0;
+	lapicipi(c->apicid, T_IRQ0 + IRQ_WAKE);
+	return 1;
+}
+
+// The CPU whose queue p should go on: the one p last ran on,
+// else this one, else the first that p may run on.
+static int
+pickcpu(struct proc *p)
+{
+	int id;
+
+	if(p->cpu >= 0 && CANRUN(p, p->cpu))
+		return p->cpu;
+	id = cpuid();
+	if(CANRUN(p, id))
+		return id;
+	for(id = 0; id < ncpu; id++)
+		if(CANRUN(p, id))
+			break;
+	return id;
+}
+
+// Make p RUNNABLE and queue it on the CPU picked for it.
+// If that CPU is busy running a process, have an idle CPU
+// that may run p come and steal it.
+// The ptable lock must be held.
+static void
+setrunnable(struct proc *p)
+{
+	struct cpu *c;
+	struct runq *rq;
+
+	p->state = RUNNABLE;
+	c = &cpus[pickcpu(p)];
+	rq = &runq[c - cpus];
+	acquire(&rq->lock);
+	runqput(rq, p);
+	release(&rq->lock);
+
+	if(c == mycpu()){
+		if(c->proc == 0 || c->proc == p)
+			return;
+	} else if(kick(c) || c->proc == 0)
+		return;
+	for(c = cpus; c < &cpus[ncpu]; c++)
+		if(CANRUN(p, c - cpus) && kick(c))
+			break;
+}
+
+// Take p off whatever queue it is on. Returns 1 if it was queued.
+// The ptable lock must be held.
+static int
+runqremove(struct proc *p)
+{
+	struct runq *rq;
+	struct proc **pp, *prev;
+	int l;
+
+	for(rq = runq; rq < &runq[ncpu]; rq++){
+		acquire(&rq->lock);
+		for(l = 0; l < NPRIO; l++){
+			prev = 0;
+			for(pp = &rq->level[l].head; *pp; pp = &(*pp)->rqnext){
+				if(*pp == p){
+					*pp = p->rqnext;
+					if(rq->level[l].tail == p)
+						rq->level[l].tail = prev;
+					rq->n--;
+					release(&rq->lock);
+					return 1;
+				}
+				prev = *pp;
+			}
+		}
+		release(&rq->lock);
+	}
+	return 0;
+}
+
+// Is a process that CPU id may run queued anywhere?
+static int
+runqwaiting(int id)
+{
+	struct runq *rq;
+	struct proc *p;
+	int l, found;
+
+	found = 0;
+	for(rq = runq; rq < &runq[ncpu] && !found; rq++){
+		if(rq->n == 0)
+			continue;
+		acquire(&rq->lock);
+		for(l = 0; l < NPRIO && !found; l++)
+			for(p = rq->level[l].head; p && !found; p = p->rqnext)
+				found = CANRUN(p, id);
+		release(&rq->lock);
+	}
+	return found;
+}
+
+// Halt CPU c until there is work for it. Called with
+// interrupts enabled, from the scheduler.
+//
+// With TICKLESS the timer is stopped while halted, and other
+// CPUs kick() this one when they queue work. CPU 0 keeps time,
+// so it stops ticking only while every CPU is idle, and then
+// sets a one-shot timer for the next sleep() deadline. A CPU
+// that wakes up restarts CPU 0's tick before running anything.
+// A CPU whose tick is cut short for sleeptsc() keeps its timer.
+static void
+idle(struct cpu *c)
+{
+	struct cpu *c1;
+	uint n, spent, armed;
+
+	if(!TICKLESS || lapictick == 0 || c->wakeat || c->shortarmed){
+		hlt();
+		return;
+	}
+
+	cli();
+	xchg(&c->idle, 1);
+	if(runqwaiting(c - cpus))
+		goto out;
+	if(c != cpus){
+		lapicstop();
+		stihlt();
+		cli();
+		lapicperiodic();
+		goto out;
+	}
+
+	xchg(&c->tickless, 1);
+	for(c1 = cpus+1; c1 < &cpus[ncpu]; c1++)
+		if(!c1->idle)
+			break;
+	if(c1 < &cpus[ncpu] || runqwaiting(0)){
+		// Somebody may be running: keep ticking.
+		xchg(&c->tickless, 0);
+		stihlt();
+		cli();
+		goto out;
+	}
+	spent = lapicstop();
+	n = clocknext();
+	if(n == 0 || n > 0xFFFFFFFF / lapictick)
+		armed = 0xFFFFFFFF;
+	else
+		armed = n*lapictick - spent;
+	lapiconeshot(armed);
+	stihlt();
+	cli();
+	spent += armed - lapicleft();
+	lapicperiodic();
+	xchg(&c->tickless, 0);
+	clockadvance(spent);
+
+out:
+	xchg(&c->idle, 0);
+	if(c != cpus && cpus[0].tickless)
+		kick(&cpus[0]);
+	sti();
+}
+
+// Take the first process that CPU id may run, from the highest
+// level that has one, off rq, or return 0.
+static struct proc*
+runqpop(struct runq *rq, int id)
+{
+	struct proc *p, *prev;
+	int l;
+
+	if(rq->n == 0)  // racy peek; saves taking an idle queue's lock
+		return 0;
+	p = 0;
+	acquire(&rq->lock);
+	for(l = 0; l < NPRIO && p == 0; l++){
+		prev = 0;
+		for(p = rq->level[l].head; p && !CANRUN(p, id); p = p->rqnext)
+			prev = p;
+		if(p == 0)
+			continue;
+		if(prev)
+			prev->rqnext = p->rqnext;
+		else
+			rq->level[l].head = p->rqnext;
+		if(rq->level[l].tail == p)
+			rq->level[l].tail = prev;
+		rq->n--;
+	}
+	release(&rq->lock);
+	return p;
+}
+
+// Pick the next process for CPU c: from its own queue,
+// or else stolen from the other CPUs in turn.
+static struct proc*
+runqget(struct cpu *c)
+{
+	struct proc *p;
+	int i, id;
+
+	id = c - cpus;
+	if((p = runqpop(&runq[id], id)) != 0)
+		return p;
+	for(i = 1; i < ncpu; i++)
+		if((p = runqpop(&runq[(id + i) % ncpu], id)) != 0)
+			return p;
+	return 0;
 }
 
 // Must be called with interrupts disabled
@@ -67,7 +364,70 @@ myproc(void)
 	return p;
 }
 
-// Look in the process table for an UNUSED proc.
+// Put p back on the free list and take it out of the pid hash.
+// The ptable lock must be held.
+static void
+freeproc(struct proc *p)
+{
+	*p->pidprev = p->pidnext;
+	if(p->pidnext)
+		p->pidnext->pidprev = p->pidprev;
+	p->pid = 0;
+	p->state = UNUSED;
+	p->pidnext = ptable.free;
+	ptable.free = p;
+}
+
+// Give back a process from allocproc() that never ran.
+static void
+unalloc(struct proc *p)
+{
+	if(p->kstack)
+		kfree(p->kstack);
+	p->kstack = 0;
+	acquire(&ptable.lock);
+	freeproc(p);
+	release(&ptable.lock);
+}
+
+// Make p a child of parent.
+// The ptable lock must be held.
+static void
+addchild(struct proc *parent, struct proc *p)
+{
+	p->parent = parent;
+	p->sibling = parent->children;
+	if(p->sibling)
+		p->sibling->sibprev = &p->sibling;
+	p->sibprev = &parent->children;
+	parent->children = p;
+}
+
+// Take p off its parent's list of children.
+// The ptable lock must be held.
+static void
+delchild(struct proc *p)
+{
+	*p->sibprev = p->sibling;
+	if(p->sibling)
+		p->sibling->sibprev = p->sibprev;
+	p->parent = 0;
+}
+
+// The process with the given pid, or 0.
+// The ptable lock must be held.
+static struct proc*
+findproc(int pid)
+{
+	struct proc *p;
+
+	for(p = pidhash[PIDHASH(pid)]; p; p = p->pidnext)
+		if(p->pid == pid)
+			return p;
+	return 0;
+}
+
+// Take an UNUSED proc off the free list.
 // If found, change state to EMBRYO and initialize
 // state required to run in the kernel.
 // Otherwise return 0.
@@ -83,17 +443,35 @@ allocproc(void)
 	acquire(&ptable.lock);
 
 	// Trazimo taj proces
-	for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-		if(p->state == UNUSED)
-			goto found;
-
-	release(&ptable.lock);
-	return 0;
+	if((p = ptable.free) != 0)
+		ptable.free = p->pidnext;
+	else if(ptable.nproc < NPROC && (p = kmalloc(sizeof(*p))) != 0){
+		p->allnext = ptable.all;
+		ptable.all = p;
+		ptable.nproc++;
+	} else {
+		release(&ptable.lock);
+		return 0;
+	}
 
-found:
 	// Nasli smo proces
 	p->state = EMBRYO;
 	p->pid = nextpid++;
+	p->pidnext = pidhash[PIDHASH(p->pid)];
+	if(p->pidnext)
+		p->pidnext->pidprev = &p->pidnext;
+	p->pidprev = &pidhash[PIDHASH(p->pid)];
+	*p->pidprev = p;
+	p->children = 0;
+	p->prio = 0;
+	p->slice = 0;
+	p->nice = 0;
+	p->cpu = -1;
+	p->affinity = ~0;
+	p->runs = 0;
+	p->migrations = 0;
+	p->thread = 0;
+	p->tnext = p->tprev = p;
 
 	release(&ptable.lock);
 
@@ -103,7 +481,7 @@ found:
 		// Ako se desi greska stavimo ga kao nekoriscenog
 		// I vracamo u tabelu
 		// Da moze neko drugi da iskoristi
-		p->state = UNUSED;
+		unalloc(p);
 		return 0;
 	}
 	// Stavljamo da stack pointer bude kstack + KSTACKSIZE
@@ -174,6 +552,8 @@ userinit(void)
 
 	safestrcpy(p->name, "initcode", sizeof(p->name));
 	p->cwd = namei("/");
+	if((p->fdt = fdtalloc()) == 0 || mmapnew(p) < 0)
+		panic("userinit: no fd table or vmspace");
 
 	// this assignment to p->state lets other cores
 	// run this process. the acquire forces the above
@@ -181,7 +561,7 @@ userinit(void)
 	// because the assignment might not be atomic.
 	acquire(&ptable.lock);
 
-	p->state = RUNNABLE;
+	setrunnable(p);
 
 	release(&ptable.lock);
 }
@@ -193,18 +573,32 @@ growproc(int n)
 {
 	uint sz;
 	struct proc *curproc = myproc();
+	struct proc *p;
 
+	// Threads sharing the page table grow it one at a time.
+	mmaplock(curproc);
 	sz = curproc->sz;
 	if(n > 0){
+		if(sz + n > MMAPBASE || sz + n < sz)
+			goto bad;
 		if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
-			return -1;
+			goto bad;
 	} else if(n < 0){
-		if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
-			return -1;
+		if((sz = shrinkuvm(curproc->pgdir, sz, sz + n)) == 0)
+			goto bad;
 	}
-	curproc->sz = sz;
-	switchuvm(curproc);
+	acquire(&ptable.lock);
+	p = curproc;
+	do {
+		p->sz = sz;
+	} while((p = p->tnext) != curproc);
+	release(&ptable.lock);
+	mmapunlock(curproc);
 	return 0;
+
+bad:
+	mmapunlock(curproc);
+	return -1;
 }
 
 // Create a new process copying p as the parent.
@@ -218,7 +612,7 @@ growproc(int n)
 int
 fork(void)
 {
-	int i, pid;
+	int pid;
 	struct proc *np;
 	struct proc *curproc = myproc();
 
@@ -230,27 +624,33 @@ fork(void)
 
 	// Copy process state from proc.
 	// Kopiramo celu virtuelnu memoriju
-	if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
-		kfree(np->kstack);
-		np->kstack = 0;
-		np->state = UNUSED;
+	// A thread may be shrinking the memory meanwhile.
+	mmaplock(curproc);
+	np->sz = curproc->sz;
+	np->pgdir = copyuvm(curproc->pgdir, np->sz);
+	mmapunlock(curproc);
+	if(np->pgdir == 0){
+		unalloc(np);
+		return -1;
+	}
+	if(mmapcopy(curproc, np) < 0 || (np->fdt = fdtcopy(curproc->fdt)) == 0){
+		mmapclear(np);
+		freevm(np->pgdir);
+		np->pgdir = 0;
+		unalloc(np);
 		return -1;
 	}
 	// Kopiramo velicinu starog procesa u novi
 	// Stavljamo mu parent, i kopiramo trapframe (stanje procesas)
-	np->sz = curproc->sz;
-	np->parent = curproc;
+	np->nice = np->prio = curproc->nice;
+	np->affinity = curproc->affinity;
 	*np->tf = *curproc->tf;
 
 	// Clear %eax so that fork returns 0 in the child.
 	// Zbog ove linije kada zovemo fork() ono vraca 2 vrednosti
 	np->tf->eax = 0;
 
-	// Kopiramo sve fajlove koje smo otvorili
-	for(i = 0; i < NOFILE; i++)
-		if(curproc->ofile[i])
-			// Tako sto iz dupujemo
-			np->ofile[i] = filedup(curproc->ofile[i]);
+	// Fajlove smo vec kopirali sa fdtcopy
 	np->cwd = idup(curproc->cwd); // Kopiramo cwd
 
 	// Kopiramo ime
@@ -262,13 +662,89 @@ fork(void)
 	acquire(&ptable.lock);
 
 	// Stavimo kao runnable i vratimo
-	np->state = RUNNABLE;
+	addchild(curproc, np);
+	setrunnable(np);
 
 	release(&ptable.lock);
 
 	return pid;
 }
 
+// Create a thread: a new process that shares the caller's page
+// table, mappings and open files, and starts at fn(arg) on the
+// user stack that stack points to the top of.
+// Returns the new thread's pid, to be passed to join().
+int
+clone(uint fn, uint arg, uint stack)
+{
+	int pid;
+	uint ustack[2];
+	struct proc *np;
+	struct proc *curproc = myproc();
+
+	if(stack < 2*sizeof(uint))
+		return -1;
+	if((np = allocproc()) == 0)
+		return -1;
+
+	// Fake return PC and argument for fn.
+	ustack[0] = 0xffffffff;
+	ustack[1] = arg;
+	stack -= sizeof(ustack);
+	if(stack + sizeof(ustack) > curproc->sz &&
+	   mmapaccess(stack, sizeof(ustack), 1) < 0)
+		goto bad;
+	if(ucopy((void*)stack, ustack, sizeof(ustack)) < 0)
+		goto bad;
+
+	np->pgdir = curproc->pgdir;
+	np->sz = curproc->sz;
+	np->thread = 1;
+	np->ustack = stack + sizeof(ustack);
+	np->nice = np->prio = curproc->nice;
+	np->affinity = curproc->affinity;
+	*np->tf = *curproc->tf;
+	np->tf->eip = fn;
+	np->tf->esp = stack;
+	np->tf->eax = 0;
+	mmapshare(curproc, np);
+	np->fdt = fdtdup(curproc->fdt);
+	np->cwd = idup(curproc->cwd);
+	safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+	pid = np->pid;
+
+	acquire(&ptable.lock);
+	np->tnext = curproc->tnext;
+	np->tprev = curproc;
+	curproc->tnext->tprev = np;
+	curproc->tnext = np;
+	addchild(curproc, np);
+	setrunnable(np);
+	release(&ptable.lock);
+
+	return pid;
+
+bad:
+	unalloc(np);
+	return -1;
+}
+
+// Take p out of the ring of processes that share its page table,
+// for exec(). Returns 1 if nobody else uses the page table.
+int
+unshare(struct proc *p)
+{
+	int last;
+
+	acquire(&ptable.lock);
+	last = p->tnext == p;
+	p->tnext->tprev = p->tprev;
+	p->tprev->tnext = p->tnext;
+	p->tnext = p->tprev = p;
+	release(&ptable.lock);
+	return last;
+}
+
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait() to find out it exited.
@@ -279,19 +755,18 @@ exit(void)
 {
 	struct proc *curproc = myproc();
 	struct proc *p;
-	int fd;
 
 	if(curproc == initproc)
 		panic("init exiting");
 
-	// Close all open files.
+	// Drop mappings first: shared pages are written back
+	// through the files they hold.
+	mmapclear(curproc);
+
+	// Close all open files, unless other threads still use them.
 	// Zatvara sve otvorene fajlove
-	for(fd = 0; fd < NOFILE; fd++){
-		if(curproc->ofile[fd]){
-			fileclose(curproc->ofile[fd]);
-			curproc->ofile[fd] = 0;
-		}
-	}
+	fdtclose(curproc->fdt);
+	curproc->fdt = 0;
 
 	begin_op();
 	iput(curproc->cwd); // Otpusti current working directory
@@ -304,13 +779,14 @@ exit(void)
 	// Probudi roditelja procesa
 	wakeup1(curproc->parent);
 
-	// Pass abandoned children to init.
-	for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-		if(p->parent == curproc){
-			p->parent = initproc; // Stavlja parent na init
-			if(p->state == ZOMBIE)
-				wakeup1(initproc);
-		}
+	// Pass abandoned children to init, which reaps threads
+	// with wait() like any other child.
+	while((p = curproc->children) != 0){
+		delchild(p);
+		addchild(initproc, p); // Stavlja parent na init
+		p->thread = 0;
+		if(p->state == ZOMBIE)
+			wakeup1(initproc);
 	}
 
 	// Jump into the scheduler, never to return.
@@ -319,6 +795,29 @@ exit(void)
 	panic("zombie exit");
 }
 
+// Free the remains of zombie p. Its page table goes only with
+// the last process sharing it.
+// The ptable lock must be held.
+static void
+reap(struct proc *p)
+{
+	kfree(p->kstack);
+	p->kstack = 0;
+	if(p->tnext == p)
+		freevm(p->pgdir);
+	else {
+		p->tnext->tprev = p->tprev;
+		p->tprev->tnext = p->tnext;
+		p->tnext = p->tprev = p;
+	}
+	p->pgdir = 0;
+	delchild(p);
+	p->name[0] = 0;
+	p->killed = 0;
+	p->thread = 0;
+	freeproc(p); // Da bi posle opet mogao da se koristi
+}
+
 // Wait for a child process to exit and return its pid.
 // Return -1 if this process has no children.
 int
@@ -330,12 +829,11 @@ wait(void)
 
 	acquire(&ptable.lock);
 	for(;;){
-		// Scan through table looking for exited children.
-		// Skeniramo kroz tabelu i gledamo da li imamo
-		// Decu
+		// Scan through our children looking for exited ones.
+		// Skeniramo kroz listu dece
 		havekids = 0;
-		for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-			if(p->parent != curproc)
+		for(p = curproc->children; p; p = p->sibling){
+			if(p->thread)
 				continue;
 			havekids = 1; // Imamo
 			// Ako je zombie onda smo docekali da jedan od nasih
@@ -345,14 +843,7 @@ wait(void)
 			if(p->state == ZOMBIE){
 				// Found one.
 				pid = p->pid;
-				kfree(p->kstack);
-				p->kstack = 0;
-				freevm(p->pgdir);
-				p->pid = 0;
-				p->parent = 0;
-				p->name[0] = 0;
-				p->killed = 0;
-				p->state = UNUSED; // Da bi posle opet mogao da se koristi
+				reap(p);
 				release(&ptable.lock);
 				// Ovo je uradjeno da bi roditelju bila vracena
 				// Informacija o id-u detetovog procesa
@@ -373,6 +864,41 @@ wait(void)
 	}
 }
 
+// Wait for thread tid, or any thread if tid is 0, created by
+// the current process with clone() to exit. Stores the stack
+// pointer it was given in *stack, and returns its pid.
+int
+join(int tid, uint *stack)
+{
+	struct proc *p;
+	int havekids, pid;
+	struct proc *curproc = myproc();
+
+	acquire(&ptable.lock);
+	for(;;){
+		havekids = 0;
+		for(p = curproc->children; p; p = p->sibling){
+			if(!p->thread)
+				continue;
+			if(tid != 0 && p->pid != tid)
+				continue;
+			havekids = 1;
+			if(p->state == ZOMBIE){
+				pid = p->pid;
+				*stack = p->ustack;
+				reap(p);
+				release(&ptable.lock);
+				return pid;
+			}
+		}
+		if(!havekids || curproc->killed){
+			release(&ptable.lock);
+			return -1;
+		}
+		sleep(curproc, &ptable.lock);
+	}
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
@@ -386,45 +912,55 @@ wait(void)
 void
 scheduler(void)
 {
-	int idle;
 	struct proc *p;
 	struct cpu *c = mycpu();
 	c->proc = 0;
 
-	idle = 0;
 	for(;;){
 		// Enable interrupts on this processor.
 		sti();
 
-		// If there are no processes to run, halt the CPU
-		// until the next interrupt.
-		if(idle)
-			hlt();
-		idle = 1;
+		// If there are no processes to run, spend the time
+		// zeroing free pages for kzalloc(), and halt the CPU
+		// until there is work once there is none left.
+		if((p = runqget(c)) == 0){
+			if(kzeroidle() == 0)
+				idle(c);
+			continue;
+		}
 
-		// Loop over process table looking for process to run.
+		// p is ours now, but the CPU that queued it may still
+		// be switching away from it: ptable.lock is held until
+		// that switch is done.
 		acquire(&ptable.lock);
-		for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+		do {
 			if(p->state != RUNNABLE)
-				continue;
-
-			idle = 0;
+				panic("scheduler: queued proc not runnable");
 			// Switch to chosen process.  It is the process's job
 			// to release ptable.lock and then reacquire it
 			// before jumping back to us.
 			c->proc = p;
 			switchuvm(p);
 			p->state = RUNNING;
+			if(p->cpu >= 0 && p->cpu != c - cpus)
+				p->migrations++;
+			p->cpu = c - cpus;
+			p->runs++;
 
 			swtch(&(c->scheduler), p->context);
-			switchkvm();
 
 			// Process is done running for now.
 			// It should have changed its p->state before coming back.
+			// Its page directory stays loaded until the next
+			// switchuvm(): the scheduler only touches kernel memory,
+			// which every page directory maps, and nobody can free
+			// the directory while we hold ptable.lock.
 			c->proc = 0;
-		}
+		} while((p = runqget(c)) != 0);
+		// Let go of the last process's page directory before
+		// dropping ptable.lock, since wait() or exec() may free it.
+		switchkvm();
 		release(&ptable.lock);
-
 	}
 }
 
@@ -462,11 +998,163 @@ yield(void)
 	acquire(&ptable.lock);  //DOC: yieldlock
 	// Stavljamo stanje procesora na runnable
 	// I zovemo sched funkciju
-	myproc()->state = RUNNABLE;
+	setrunnable(myproc());
 	sched();
 	release(&ptable.lock);
 }
 
+// Charge the current process for one timer tick. Once it has
+// used up the time slice of its level, move it down a level and
+// give up the CPU; give it up early, without penalty, if something
+// of higher priority is waiting on this CPU, or if the process
+// may no longer run on this CPU.
+void
+proctick(void)
+{
+	struct proc *p = myproc();
+	struct runq *rq = &runq[cpuid()];
+	int l;
+
+	if(!CANRUN(p, cpuid())){
+		yield();
+		return;
+	}
+	if(++p->slice >= (1 << p->prio)){
+		if(p->prio < NPRIO-1)
+			p->prio++;
+		p->slice = 0;
+		yield();
+		return;
+	}
+	for(l = 0; l < p->prio; l++){
+		if(rq->level[l].head){  // racy peek is fine here
+			yield();
+			return;
+		}
+	}
+}
+
+// Move every process back to its top priority level.
+// Called periodically from the timer interrupt.
+void
+boost(void)
+{
+	struct proc *p, *next;
+	struct runq *rq;
+	int l;
+
+	acquire(&ptable.lock);
+	for(p = ptable.all; p; p = p->allnext){
+		if(p->state == UNUSED)
+			continue;
+		p->prio = p->nice;
+		p->slice = 0;
+	}
+	// Requeue the waiting processes at their new levels,
+	// keeping their order.
+	for(rq = runq; rq < &runq[ncpu]; rq++){
+		acquire(&rq->lock);
+		p = 0;
+		for(l = NPRIO-1; l >= 0; l--){
+			if(rq->level[l].tail){
+				rq->level[l].tail->rqnext = p;
+				p = rq->level[l].head;
+			}
+			rq->level[l].head = rq->level[l].tail = 0;
+		}
+		rq->n = 0;
+		for(; p; p = next){
+			next = p->rqnext;
+			runqput(rq, p);
+		}
+		release(&rq->lock);
+	}
+	release(&ptable.lock);
+}
+
+// Set the niceness of process pid (0 for the caller): the
+// highest priority level it runs at, 0 (the default) to NPRIO-1.
+// Returns the old niceness, or -1.
+int
+setnice(int pid, int nice)
+{
+	struct proc *p;
+	int old;
+
+	if(nice < 0 || nice >= NPRIO)
+		return -1;
+	if(pid == 0)
+		pid = myproc()->pid;
+	acquire(&ptable.lock);
+	if((p = findproc(pid)) != 0){
+		old = p->nice;
+		p->nice = nice;
+		if(p->prio < nice)
+			p->prio = nice;
+		release(&ptable.lock);
+		return old;
+	}
+	release(&ptable.lock);
+	return -1;
+}
+
+// Restrict process pid (0 for the caller) to the CPUs in mask,
+// bit i standing for CPU i; a mask of 0 only reads the current
+// one. Returns the old mask, or -1.
+int
+setaffinity(int pid, int mask)
+{
+	struct proc *p;
+	int old, id;
+
+	if(mask != 0 && (mask &= (1 << ncpu) - 1) == 0)
+		return -1;
+	if(pid == 0)
+		pid = myproc()->pid;
+	acquire(&ptable.lock);
+	if((p = findproc(pid)) == 0){
+		release(&ptable.lock);
+		return -1;
+	}
+	old = p->affinity & ((1 << ncpu) - 1);
+	if(mask != 0){
+		p->affinity = mask;
+		// Move it if it is waiting on a queue for the wrong
+		// CPU; if running, it moves at its next tick.
+		if(p->state == RUNNABLE && runqremove(p))
+			setrunnable(p);
+	}
+	id = cpuid();
+	release(&ptable.lock);
+	if(p == myproc() && !CANRUN(p, id))
+		yield();
+	return old;
+}
+
+// Fill in *ps with the scheduling statistics of process pid
+// (0 for the caller). Returns 0, or -1 if there is no such process.
+int
+procstat(int pid, struct pstat *ps)
+{
+	struct proc *p;
+
+	if(pid == 0)
+		pid = myproc()->pid;
+	acquire(&ptable.lock);
+	if((p = findproc(pid)) != 0){
+		ps->pid = p->pid;
+		ps->cpu = p->cpu;
+		ps->affinity = p->affinity & ((1 << ncpu) - 1);
+		ps->prio = p->prio;
+		ps->runs = p->runs;
+		ps->migrations = p->migrations;
+		release(&ptable.lock);
+		return 0;
+	}
+	release(&ptable.lock);
+	return -1;
+}
+
 // A fork child's very first scheduling by scheduler()
 // will swtch here.  "Return" to user space.
 void
@@ -516,6 +1204,11 @@ sleep(void *chan, struct spinlock *lk)
 	// Go to sleep.
 	p->chan = chan;
 	p->state = SLEEPING;
+	p->chnext = sleepq[SLEEPQ(chan)];
+	if(p->chnext)
+		p->chnext->chprev = &p->chnext;
+	p->chprev = &sleepq[SLEEPQ(chan)];
+	*p->chprev = p;
 
 	sched(); // Aktiviramo neki drugi proces za izvrsavanje
 	// Nakon sto smo stavili ovaj proces na spavanje
@@ -534,20 +1227,77 @@ sleep(void *chan, struct spinlock *lk)
 	}
 }
 
+// Take sleeping process p out of its sleepq bucket and make
+// it RUNNABLE. The ptable lock must be held.
+static void
+unsleep(struct proc *p)
+{
+	*p->chprev = p->chnext;
+	if(p->chnext)
+		p->chnext->chprev = p->chprev;
+	setrunnable(p);
+}
+
 // Wake up all processes sleeping on chan.
 // The ptable lock must be held.
 static void
 wakeup1(void *chan)
 {
-	struct proc *p;
+	struct proc *p, *next;
 
-	// Prolazi kroz tabelu procesa
-	for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+	// Prolazi kroz spavace u bucketu kanala
+	for(p = sleepq[SLEEPQ(chan)]; p; p = next){
+		next = p->chnext;
 		// Uzima sleeping proces koji ceka na kanalu
 		// Koji smo prosledili
-		if(p->state == SLEEPING && p->chan == chan)
+		if(p->chan == chan)
 			// I stavlja taj proces na runnable
-			p->state = RUNNABLE;
+			unsleep(p);
+	}
+}
+
+// Wake up at most n processes sleeping on chan.
+// Returns how many were woken.
+int
+wakeupn(void *chan, int n)
+{
+	struct proc *p, *next;
+	int woken;
+
+	woken = 0;
+	acquire(&ptable.lock);
+	for(p = sleepq[SLEEPQ(chan)]; p && woken < n; p = next){
+		next = p->chnext;
+		if(p->chan == chan){
+			unsleep(p);
+			woken++;
+		}
+	}
+	release(&ptable.lock);
+	return woken;
+}
+
+// Futex operation on the kernel address of a user word.
+int
+futex(int *key, int op, int val)
+{
+	int r;
+
+	r = -1;
+	acquire(&futexlock);
+	switch(op){
+	case FUTEX_WAIT:
+		if(*key == val && !myproc()->killed){
+			sleep(key, &futexlock);
+			r = 0;
+		}
+		break;
+	case FUTEX_WAKE:
+		r = wakeupn(key, val);
+		break;
+	}
+	release(&futexlock);
+	return r;
 }
 
 // Wake up all processes sleeping on chan.
@@ -559,6 +1309,78 @@ wakeup(void *chan)
 	release(&ptable.lock);
 }
 
+// Put e on queue q for the current process.
+// Caller must hold lk, the lock that protects q.
+void
+pollqadd(struct pollent **q, struct pollent *e, struct spinlock *lk)
+{
+	e->p = myproc();
+	e->lk = lk;
+	e->next = *q;
+	if(e->next)
+		e->next->prev = &e->next;
+	e->prev = q;
+	*q = e;
+}
+
+// Take e off its queue, if it is on one.
+void
+pollqdel(struct pollent *e)
+{
+	if(e->prev == 0)
+		return;
+	acquire(e->lk);
+	*e->prev = e->next;
+	if(e->next)
+		e->next->prev = e->prev;
+	e->prev = 0;
+	release(e->lk);
+}
+
+// Wake the processes on queue q.
+// Caller must hold the lock that protects q.
+void
+pollwakeup(struct pollent *q)
+{
+	if(q == 0)
+		return;
+	acquire(&ptable.lock);
+	for(; q; q = q->next){
+		q->p->pollwoken = 1;
+		wakeup1(&q->p->pollwoken);
+	}
+	release(&ptable.lock);
+}
+
+// Sleep until a queue the current process is on is woken,
+// the process is killed or, if timed, the clock reaches tick
+// deadline. Returns 1 if the deadline has passed.
+int
+pollsleep(int timed, uint deadline)
+{
+	struct proc *p = myproc();
+	int expired;
+
+	if(timed){
+		acquire(&tickslock);
+		settimer(&p->timer, deadline, &p->pollwoken);
+		release(&tickslock);
+	}
+	acquire(&ptable.lock);
+	while(!p->pollwoken && !p->killed &&
+	      !(timed && (int)(ticks - deadline) >= 0))
+		sleep(&p->pollwoken, &ptable.lock);
+	p->pollwoken = 0;
+	expired = timed && (int)(ticks - deadline) >= 0;
+	release(&ptable.lock);
+	if(timed){
+		acquire(&tickslock);
+		canceltimer(&p->timer);
+		release(&tickslock);
+	}
+	return expired;
+}
+
 // Kill the process with the given pid.
 // Process won't exit until it returns
 // to user space (see trap in trap.c).
@@ -568,15 +1390,13 @@ kill(int pid)
 	struct proc *p;
 
 	acquire(&ptable.lock);
-	for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-		if(p->pid == pid){
-			p->killed = 1;
-			// Wake process from sleep if necessary.
-			if(p->state == SLEEPING)
-				p->state = RUNNABLE;
-			release(&ptable.lock);
-			return 0;
-		}
+	if((p = findproc(pid)) != 0){
+		p->killed = 1;
+		// Wake process from sleep if necessary.
+		if(p->state == SLEEPING)
+			unsleep(p);
+		release(&ptable.lock);
+		return 0;
 	}
 	release(&ptable.lock);
 	return -1;
@@ -601,14 +1421,14 @@ procdump(void)
 	char *state;
 	uint pc[10];
 
-	for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+	for(p = ptable.all; p; p = p->allnext){
 		if(p->state == UNUSED)
 			continue;
 		if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
 			state = states[p->state];
 		else
 			state = "???";
-		cprintf("%d %s %s", p->pid, state, p->name);
+		cprintf("%d %s %s prio %d cpu %d", p->pid, state, p->name, p->prio, p->cpu);
 		if(p->state == SLEEPING){
 			getcallerpcs((uint*)p->context->ebp+2, pc);
 			for(i=0; i<10 && pc[i] != 0; i++)
@@ -8,6 +8,13 @@ struct cpu {
 	int ncli;                    // Depth of pushcli nesting.
 	int intena;                  // Were interrupts enabled before pushcli?
 	struct proc *proc;           // The process running on this cpu or null
+	volatile uint idle;          // Halted in idle(), waiting for a kick()
+	volatile uint tickless;      // Halted with the periodic timer off
+	volatile uint tlbreq;        // TLB flushes asked of this CPU
+	volatile uint tlbdone;       // tlbreq as of its last flush
+	uint64 wakeat;               // TSC deadline of the first sleeptsc() here, or 0
+	uint shortspent;             // Timer counts of the tick gone when the one-shot was set
+	uint shortarmed;             // Counts the one-shot timer was set for; 0 if periodic
 };
 
 extern struct cpu cpus[NCPU];
@@ -33,6 +40,24 @@ struct context {
 
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// A wakeup() at a given tick, see timer.c.
+struct timer {
+	uint expires;                // tick at which the timer fires
+	void *chan;                  // channel it wakes up
+	struct timer *next;          // next timer in the same wheel slot
+	struct timer **prev;         // link to this timer, 0 if not pending
+};
+
+// A process waiting in poll() for an object to become ready.
+// The object keeps a queue of these, protected by its own lock,
+// and calls pollwakeup() on it at each change.
+struct pollent {
+	struct proc *p;              // the waiting process
+	struct spinlock *lk;         // lock of the object queued on
+	struct pollent *next;        // next waiter on the same object
+	struct pollent **prev;       // link to this entry, 0 if not queued
+};
+
 // Per-process state
 struct proc {
 	// Svaki program pocinje od 0 i ide do neke granice
@@ -59,6 +84,12 @@ struct proc {
 	// I da cekamo da se on zavrsi
 	// Obavestimo parente
 	struct proc *parent;         // Parent process
+	struct proc *children;       // First child
+	struct proc *sibling;        // Next child of the same parent
+	struct proc **sibprev;       // Link that points to this child
+	struct proc *pidnext;        // Next in the same pid hash bucket, or free
+	struct proc **pidprev;       // Link that points to this process
+	struct proc *allnext;        // Next in the list of all processes
 	// Trap frame je na kernelskom stacku
 	// Trap frame je za userspace
 	struct trapframe *tf;        // Trap frame for current syscall
@@ -68,12 +99,29 @@ struct proc {
 	struct context *context;     // swtch() here to run process
 	// Ovo je kanal
 	void *chan;                  // If non-zero, sleeping on chan
+	struct proc *chnext;         // Next sleeper in the same sleepq bucket
+	struct proc **chprev;        // Link that points to this sleeper
+	struct timer timer;          // Wakes the process from sleep()
+	int pollwoken;               // pollwakeup() since pollsleep()
 	// Provera se uglavnom da li je proces ubijen
 	int killed;                  // If non-zero, have been killed
 	// Niz otvorenih fajlova
-	struct file *ofile[NOFILE];  // Open files
+	struct fdtable *fdt;         // Open files, shared by clone()
 	// Radni direkturijum
 	struct inode *cwd;           // Current directory
+	struct vmspace *vm;          // Memory mappings, shared by clone()
+	struct proc *tnext;          // Ring of processes sharing pgdir
+	struct proc *tprev;
+	int thread;                  // Created by clone(), reaped by join()
+	uint ustack;                 // Stack pointer given to clone()
+	struct proc *rqnext;         // Next process on the same run queue
+	int prio;                    // Priority level, 0 is the highest
+	int slice;                   // Ticks used at this level
+	int nice;                    // Highest level the process may have
+	int cpu;                     // CPU it last ran on, -1 if none yet
+	uint affinity;               // CPUs it may run on, bit i for CPU i
+	uint runs;                   // Times it was scheduled
+	uint migrations;             // Times it ran on a different CPU than before
 	char name[16];               // Process name (debugging)
 };
 
@@ -0,0 +1,9 @@
+// Scheduling statistics of a process, see getpstat().
+struct pstat {
+	int pid;
+	int cpu;          // CPU it last ran on, -1 if none yet
+	uint affinity;    // CPUs it may run on, bit i for CPU i
+	int prio;         // Current priority level
+	uint runs;        // Times it was scheduled
+	uint migrations;  // Times it ran on a different CPU than before
+};
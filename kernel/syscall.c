@@ -12,6 +12,10 @@
 // Arguments on the stack, from the user call to the C
 // library system call function. The saved user %esp points
 // to a saved program counter, and then the first argument.
+//
+// Another thread of the process can shrink or unmap its memory
+// at any time, so the kernel only touches user memory through
+// ucopy(), which fails instead of faulting.
 
 // Fetch the int at addr from the current process.
 int
@@ -21,26 +25,23 @@ fetchint(uint addr, int *ip)
 
 	if(addr >= curproc->sz || addr+4 > curproc->sz)
 		return -1;
-	*ip = *(int*)(addr);
-	return 0;
+	return ucopy(ip, (int*)addr, sizeof(*ip));
 }
 
-// Fetch the nul-terminated string at addr from the current process.
-// Doesn't actually copy the string - just sets *pp to point at it.
+// Copy the nul-terminated string at addr from the current process
+// into buf, which holds max bytes.
 // Returns length of string, not including nul.
 int
-fetchstr(uint addr, char **pp)
+fetchstr(uint addr, char *buf, int max)
 {
-	char *s, *ep;
 	struct proc *curproc = myproc();
+	int i;
 
-	if(addr >= curproc->sz)
-		return -1;
-	*pp = (char*)addr;
-	ep = (char*)curproc->sz;
-	for(s = *pp; s < ep; s++){
-		if(*s == 0)
-			return s - *pp;
+	for(i = 0; i < max; i++){
+		if(addr+i >= curproc->sz || ucopy(buf+i, (char*)addr+i, 1) < 0)
+			return -1;
+		if(buf[i] == 0)
+			return i;
 	}
 	return -1;
 }
@@ -52,34 +53,65 @@ argint(int n, int *ip)
 	return fetchint((myproc()->tf->esp) + 4 + 4*n, ip);
 }
 
-// Fetch the nth word-sized system call argument as a pointer
-// to a block of memory of size bytes.  Check that the pointer
-// lies within the process address space.
+// Check that the size bytes at addr, which the kernel will write
+// if write is set, lie within the current process's address space:
+// either below sz, or inside one mmap() region, whose pages are
+// filled in now so that ucopy() normally finds them.
 int
-argptr(int n, char **pp, int size)
+useraccess(uint addr, int size, int write)
 {
-	int i;
 	struct proc *curproc = myproc();
 
+	if(size < 0)
+		return -1;
+	if(addr >= curproc->sz || addr+size > curproc->sz){
+		if(addr < MMAPBASE || mmapaccess(addr, size, write) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+// Fetch the nth word-sized system call argument as a pointer
+// to a block of memory of size bytes, see useraccess(). The
+// memory must only be accessed with ucopy().
+static int
+argptr1(int n, char **pp, int size, int write)
+{
+	int i;
+
 	if(argint(n, &i) < 0)
 		return -1;
-	if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+	if(useraccess((uint)i, size, write) < 0)
 		return -1;
 	*pp = (char*)i;
 	return 0;
 }
 
-// Fetch the nth word-sized system call argument as a string pointer.
-// Check that the pointer is valid and the string is nul-terminated.
-// (There is no shared writable memory, so the string can't change
-// between this check and being used by the kernel.)
+// Fetch the nth word-sized system call argument as a pointer
+// to a block of memory of size bytes that the kernel reads.
+int
+argptr(int n, char **pp, int size)
+{
+	return argptr1(n, pp, size, 0);
+}
+
+// Like argptr, for memory that the kernel writes to.
+int
+argptrw(int n, char **pp, int size)
+{
+	return argptr1(n, pp, size, 1);
+}
+
+// Fetch the nth word-sized system call argument as a string,
+// copied into buf, which holds max bytes.
+// Returns the string's length, or -1.
 int
-argstr(int n, char **pp)
+argstr(int n, char *buf, int max)
 {
 	int addr;
 	if(argint(n, &addr) < 0)
 		return -1;
-	return fetchstr(addr, pp);
+	return fetchstr(addr, buf, max);
 }
 
 extern int sys_chdir(void);
@@ -104,6 +136,23 @@ extern int sys_wait(void);
 extern int sys_write(void);
 extern int sys_uptime(void);
 extern int sys_symlink(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_nice(void);
+extern int sys_usleep(void);
+extern int sys_clone(void);
+extern int sys_join(void);
+extern int sys_futex(void);
+extern int sys_affinity(void);
+extern int sys_getpstat(void);
+extern int sys_splice(void);
+extern int sys_readv(void);
+extern int sys_writev(void);
+extern int sys_lseek(void);
+extern int sys_pread(void);
+extern int sys_pwrite(void);
+extern int sys_poll(void);
+extern int sys_fcntl(void);
 
 // Niz pokazivaca na funkcije koje ne uzimaju nijedan argument
 // I vracaju int
@@ -130,7 +179,24 @@ static int (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
-[SYS_symlink] sys_symlink
+[SYS_symlink] sys_symlink,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_nice]    sys_nice,
+[SYS_usleep]  sys_usleep,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_futex]   sys_futex,
+[SYS_affinity] sys_affinity,
+[SYS_getpstat] sys_getpstat,
+[SYS_splice]  sys_splice,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_lseek]   sys_lseek,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_poll]    sys_poll,
+[SYS_fcntl]   sys_fcntl,
 };
 
 void
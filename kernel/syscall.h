@@ -21,3 +21,20 @@
 #define SYS_mkdir  20
 #define SYS_close  21
 #define SYS_symlink 22
+#define SYS_mmap   23
+#define SYS_munmap 24
+#define SYS_nice   25
+#define SYS_usleep 26
+#define SYS_clone  27
+#define SYS_join   28
+#define SYS_futex  29
+#define SYS_affinity 30
+#define SYS_getpstat 31
+#define SYS_splice 32
+#define SYS_readv  33
+#define SYS_writev 34
+#define SYS_lseek  35
+#define SYS_pread  36
+#define SYS_pwrite 37
+#define SYS_poll   38
+#define SYS_fcntl  39
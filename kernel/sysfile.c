@@ -15,9 +15,14 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "mman.h"
+#include "uio.h"
+#include "poll.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
+// The caller gets a reference to the file, so that a close() by
+// another thread cannot free it, and must fileclose() it when done.
 static int
 argfd(int n, int *pfd, struct file **pf)
 {
@@ -26,12 +31,14 @@ argfd(int n, int *pfd, struct file **pf)
 
 	if(argint(n, &fd) < 0)
 		return -1;
-	if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+	if((f=fdtget(myproc()->fdt, fd)) == 0)
 		return -1;
 	if(pfd)
 		*pfd = fd;
 	if(pf)
 		*pf = f;
+	else
+		fileclose(f);
 	return 0;
 }
 
@@ -40,16 +47,7 @@ argfd(int n, int *pfd, struct file **pf)
 static int
 fdalloc(struct file *f)
 {
-	int fd;
-	struct proc *curproc = myproc();
-
-	for(fd = 0; fd < NOFILE; fd++){
-		if(curproc->ofile[fd] == 0){
-			curproc->ofile[fd] = f;
-			return fd;
-		}
-	}
-	return -1;
+	return fdtadd(myproc()->fdt, f);
 }
 
 int
@@ -60,9 +58,9 @@ sys_dup(void)
 
 	if(argfd(0, 0, &f) < 0)
 		return -1;
+	// The new fd takes over argfd()'s reference.
 	if((fd=fdalloc(f)) < 0)
-		return -1;
-	filedup(f);
+		fileclose(f);
 	return fd;
 }
 
@@ -73,9 +71,264 @@ sys_read(void)
 	int n;
 	char *p;
 
-	if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+	if(argint(2, &n) < 0 || argptrw(1, &p, n) < 0 || argfd(0, 0, &f) < 0)
+		return -1;
+	n = fileread(f, p, n);
+	fileclose(f);
+	return n;
+}
+
+// Copy argument n, an array of cnt iovecs, into iov, and check
+// the buffers it describes.
+static int
+argiov(int n, int cnt, struct iovec *iov, int write)
+{
+	struct iovec *uiov;
+	int i;
+
+	if(cnt < 0 || cnt > IOV_MAX)
+		return -1;
+	if(argptr(n, (char**)&uiov, cnt*sizeof(*uiov)) < 0 ||
+	   ucopy(iov, uiov, cnt*sizeof(*uiov)) < 0)
+		return -1;
+	for(i = 0; i < cnt; i++)
+		if(useraccess((uint)iov[i].iov_base, iov[i].iov_len, write) < 0)
+			return -1;
+	return 0;
+}
+
+// int readv(int fd, struct iovec *iov, int cnt)
+// Fills the buffers in turn, stopping at the first short read,
+// so a pipe only fills the buffers its data reaches.
+int
+sys_readv(void)
+{
+	struct file *f;
+	struct iovec iov[IOV_MAX];
+	int cnt, i, r, total;
+
+	if(argint(2, &cnt) < 0 || argiov(1, cnt, iov, 1) < 0 || argfd(0, 0, &f) < 0)
+		return -1;
+	total = 0;
+	for(i = 0; i < cnt; i++){
+		if((r = fileread(f, iov[i].iov_base, iov[i].iov_len)) < 0){
+			if(total == 0)
+				total = r;
+			break;
+		}
+		total += r;
+		if(r < iov[i].iov_len || (f->type == FD_PIPE && r > 0))
+			break;
+	}
+	fileclose(f);
+	return total;
+}
+
+// int writev(int fd, struct iovec *iov, int cnt)
+int
+sys_writev(void)
+{
+	struct file *f;
+	struct iovec iov[IOV_MAX];
+	int cnt, i, r, total;
+
+	if(argint(2, &cnt) < 0 || argiov(1, cnt, iov, 0) < 0 || argfd(0, 0, &f) < 0)
+		return -1;
+	total = 0;
+	for(i = 0; i < cnt; i++){
+		if((r = filewrite(f, iov[i].iov_base, iov[i].iov_len)) < 0){
+			if(total == 0)
+				total = r;
+			break;
+		}
+		total += r;
+		if(r < iov[i].iov_len)
+			break;
+	}
+	fileclose(f);
+	return total;
+}
+
+// int splice(int fdin, int fdout, int n)
+int
+sys_splice(void)
+{
+	struct file *in, *out;
+	int n;
+
+	if(argint(2, &n) < 0 || argfd(0, 0, &in) < 0)
+		return -1;
+	if(argfd(1, 0, &out) < 0){
+		fileclose(in);
+		return -1;
+	}
+	n = filesplice(in, out, n);
+	fileclose(in);
+	fileclose(out);
+	return n;
+}
+
+// int pread(int fd, void *buf, int n, uint off)
+int
+sys_pread(void)
+{
+	struct file *f;
+	int n, off;
+	char *p;
+
+	if(argint(2, &n) < 0 || argptrw(1, &p, n) < 0 || argint(3, &off) < 0 ||
+	   argfd(0, 0, &f) < 0)
+		return -1;
+	n = filepread(f, p, n, off);
+	fileclose(f);
+	return n;
+}
+
+// int pwrite(int fd, void *buf, int n, uint off)
+int
+sys_pwrite(void)
+{
+	struct file *f;
+	int n, off;
+	char *p;
+
+	if(argint(2, &n) < 0 || argptr(1, &p, n) < 0 || argint(3, &off) < 0 ||
+	   argfd(0, 0, &f) < 0)
 		return -1;
-	return fileread(f, p, n);
+	n = filepwrite(f, p, n, off);
+	fileclose(f);
+	return n;
+}
+
+// An fd being polled: a copy of its pollfd, its file, held until
+// poll() returns, and the process's place in the file's wait queue.
+struct pollslot {
+	struct pollfd fd;
+	struct file *f;
+	struct pollent e;
+};
+
+#define NPOLLFD (PGSIZE / sizeof(struct pollslot))  // most fds per poll()
+
+// Set the revents of the cnt fds in s, queueing the process
+// on their files if queue is set. Returns how many have events.
+static int
+pollscan(struct pollslot *s, int cnt, int queue)
+{
+	struct pollfd *fd;
+	int i, n;
+
+	n = 0;
+	for(i = 0; i < cnt; i++){
+		fd = &s[i].fd;
+		if(fd->fd < 0)
+			fd->revents = 0;
+		else if(s[i].f == 0)
+			fd->revents = POLLNVAL;
+		else
+			fd->revents = filepoll(s[i].f, queue ? &s[i].e : 0) &
+			    (fd->events | POLLERR | POLLHUP);
+		if(fd->revents)
+			n++;
+	}
+	return n;
+}
+
+// int poll(struct pollfd *fds, int cnt, int timeout)
+// Wait until one of the fds has an event, or for timeout
+// milliseconds; forever if timeout is negative. Returns the
+// number of fds with events, 0 on timeout.
+int
+sys_poll(void)
+{
+	struct pollfd *fds;
+	struct pollslot *s;
+	int cnt, timeout, i, n, expired;
+	uint deadline;
+
+	if(argint(1, &cnt) < 0 || cnt < 0 || cnt > NPOLLFD ||
+	   argptrw(0, (void*)&fds, cnt*sizeof(*fds)) < 0 || argint(2, &timeout) < 0)
+		return -1;
+	if((s = (struct pollslot*)kalloc()) == 0)
+		return -1;
+	for(i = 0; i < cnt; i++){
+		if(ucopy(&s[i].fd, &fds[i], sizeof(fds[i])) < 0){
+			kfree((char*)s);
+			return -1;
+		}
+	}
+	for(i = 0; i < cnt; i++){
+		s[i].f = 0;
+		s[i].e.prev = 0;
+		if(s[i].fd.fd >= 0)
+			s[i].f = fdtget(myproc()->fdt, s[i].fd.fd);
+	}
+	deadline = ticks + (uint)timeout / 1000 * HZ +
+	    ((uint)timeout % 1000 * HZ + 999) / 1000;
+	expired = timeout == 0;
+	n = pollscan(s, cnt, !expired);
+	while(n == 0 && !expired){
+		if(myproc()->killed){
+			n = -1;
+			break;
+		}
+		expired = pollsleep(timeout > 0, deadline);
+		n = pollscan(s, cnt, 0);
+	}
+	for(i = 0; i < cnt; i++){
+		pollqdel(&s[i].e);
+		if(s[i].f)
+			fileclose(s[i].f);
+		if(n >= 0 && ucopy(&fds[i], &s[i].fd, sizeof(fds[i])) < 0)
+			n = -1;
+	}
+	kfree((char*)s);
+	return n;
+}
+
+// int fcntl(int fd, int cmd, int arg)
+// F_GETFL returns the access mode and O_NONBLOCK; F_SETFL sets
+// O_NONBLOCK from arg, for every fd that shares the file.
+int
+sys_fcntl(void)
+{
+	struct file *f;
+	int cmd, arg, flags;
+
+	if(argint(1, &cmd) < 0 || argint(2, &arg) < 0 || argfd(0, 0, &f) < 0)
+		return -1;
+	switch(cmd){
+	case F_GETFL:
+		if(f->readable && f->writable)
+			flags = O_RDWR;
+		else
+			flags = f->writable ? O_WRONLY : O_RDONLY;
+		if(f->nonblock)
+			flags |= O_NONBLOCK;
+		break;
+	case F_SETFL:
+		f->nonblock = (arg & O_NONBLOCK) != 0;
+		flags = 0;
+		break;
+	default:
+		flags = -1;
+	}
+	fileclose(f);
+	return flags;
+}
+
+// int lseek(int fd, int off, int whence)
+int
+sys_lseek(void)
+{
+	struct file *f;
+	int off, whence;
+
+	if(argint(1, &off) < 0 || argint(2, &whence) < 0 || argfd(0, 0, &f) < 0)
+		return -1;
+	off = fileseek(f, off, whence);
+	fileclose(f);
+	return off;
 }
 
 int
@@ -85,9 +338,11 @@ sys_write(void)
 	int n;
 	char *p;
 
-	if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+	if(argint(2, &n) < 0 || argptr(1, &p, n) < 0 || argfd(0, 0, &f) < 0)
 		return -1;
-	return filewrite(f, p, n);
+	n = filewrite(f, p, n);
+	fileclose(f);
+	return n;
 }
 
 int
@@ -98,7 +353,14 @@ sys_close(void)
 
 	if(argfd(0, &fd, &f) < 0)
 		return -1;
-	myproc()->ofile[fd] = 0;
+	// Another thread may be closing fd too. Drop the fd's
+	// reference, then argfd()'s: the file is freed here unless
+	// another system call is still using it.
+	if(fdtremove(myproc()->fdt, fd, f) < 0){
+		fileclose(f);
+		return -1;
+	}
+	fileclose(f);
 	fileclose(f);
 	return 0;
 }
@@ -107,21 +369,26 @@ int
 sys_fstat(void)
 {
 	struct file *f;
-	struct stat *st;
+	struct stat *ust, st;
+	int r;
 
-	if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+	if(argptrw(1, (void*)&ust, sizeof(st)) < 0 || argfd(0, 0, &f) < 0)
 		return -1;
-	return filestat(f, st);
+	r = filestat(f, &st);
+	fileclose(f);
+	if(r == 0 && ucopy(ust, &st, sizeof(st)) < 0)
+		r = -1;
+	return r;
 }
 
 // Create the path new as a link to the same inode as old.
 int
 sys_link(void)
 {
-	char name[DIRSIZ], *new, *old;
+	char name[DIRSIZ], new[MAXPATH], old[MAXPATH];
 	struct inode *dp, *ip;
 
-	if(argstr(0, &old) < 0 || argstr(1, &new) < 0)
+	if(argstr(0, old, MAXPATH) < 0 || argstr(1, new, MAXPATH) < 0)
 		return -1;
 
 	begin_op();
@@ -185,10 +452,10 @@ sys_unlink(void)
 {
 	struct inode *ip, *dp;
 	struct dirent de;
-	char name[DIRSIZ], *path;
+	char name[DIRSIZ], path[MAXPATH];
 	uint off;
 
-	if(argstr(0, &path) < 0)
+	if(argstr(0, path, MAXPATH) < 0)
 		return -1;
 
 	begin_op();
@@ -284,10 +551,10 @@ create(char *path, short type, short major, short minor)
 int
 sys_symlink(void)
 {
-	char *dest, *path;
+	char dest[MAXPATH], path[MAXPATH];
 
 	struct inode *ip;
-	if (argstr(0, &dest) < 0 || argstr(1, &path) < 0) {
+	if (argstr(0, dest, MAXPATH) < 0 || argstr(1, path, MAXPATH) < 0) {
 		return -1;
 	}
 
@@ -308,12 +575,12 @@ sys_symlink(void)
 int
 sys_open(void)
 {
-	char *path;
+	char path[MAXPATH];
 	int fd, omode;
 	struct file *f;
 	struct inode *ip;
 
-	if(argstr(0, &path) < 0 || argint(1, &omode) < 0)
+	if(argstr(0, path, MAXPATH) < 0 || argint(1, &omode) < 0)
 		return -1;
 
 	begin_op();
@@ -395,17 +662,18 @@ sys_open(void)
 	f->off = 0;
 	f->readable = !(omode & O_WRONLY);
 	f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+	f->nonblock = (omode & O_NONBLOCK) != 0;
 	return fd;
 }
 
 int
 sys_mkdir(void)
 {
-	char *path;
+	char path[MAXPATH];
 	struct inode *ip;
 
 	begin_op();
-	if(argstr(0, &path) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
+	if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
 		end_op();
 		return -1;
 	}
@@ -418,11 +686,11 @@ int
 sys_mknod(void)
 {
 	struct inode *ip;
-	char *path;
+	char path[MAXPATH];
 	int major, minor;
 
 	begin_op();
-	if((argstr(0, &path)) < 0 ||
+	if((argstr(0, path, MAXPATH)) < 0 ||
 			argint(1, &major) < 0 ||
 			argint(2, &minor) < 0 ||
 			(ip = create(path, T_DEV, major, minor)) == 0){
@@ -437,12 +705,12 @@ sys_mknod(void)
 int
 sys_chdir(void)
 {
-	char *path;
+	char path[MAXPATH];
 	struct inode *ip;
 	struct proc *curproc = myproc();
 
 	begin_op();
-	if(argstr(0, &path) < 0 || (ip = namei(path)) == 0){
+	if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
 		end_op();
 		return -1;
 	}
@@ -462,49 +730,100 @@ sys_chdir(void)
 int
 sys_exec(void)
 {
-	char *path, *argv[MAXARG];
-	int i;
+	char path[MAXPATH], *argv[MAXARG];
+	int i, r;
 	uint uargv, uarg;
 
-	if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0){
+	if(argstr(0, path, MAXPATH) < 0 || argint(1, (int*)&uargv) < 0){
 		return -1;
 	}
+	// Copy the arguments into the kernel, a page each, where
+	// other threads cannot change or unmap them.
 	memset(argv, 0, sizeof(argv));
+	r = -1;
 	for(i=0;; i++){
 		if(i >= NELEM(argv))
-			return -1;
+			goto out;
 		if(fetchint(uargv+4*i, (int*)&uarg) < 0)
-			return -1;
+			goto out;
 		if(uarg == 0){
 			argv[i] = 0;
 			break;
 		}
-		if(fetchstr(uarg, &argv[i]) < 0)
-			return -1;
+		if((argv[i] = kalloc()) == 0)
+			goto out;
+		if(fetchstr(uarg, argv[i], PGSIZE) < 0)
+			goto out;
 	}
-	return exec(path, argv);
+	r = exec(path, argv);
+
+out:
+	for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
+		kfree(argv[i]);
+	return r;
 }
 
 int
 sys_pipe(void)
 {
-	int *fd;
+	int *ufd, fd[2];
 	struct file *rf, *wf;
 	int fd0, fd1;
 
-	if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
+	if(argptrw(0, (void*)&ufd, sizeof(fd)) < 0)
 		return -1;
 	if(pipealloc(&rf, &wf) < 0)
 		return -1;
 	fd0 = -1;
 	if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
 		if(fd0 >= 0)
-			myproc()->ofile[fd0] = 0;
+			fdtremove(myproc()->fdt, fd0, rf);
 		fileclose(rf);
 		fileclose(wf);
 		return -1;
 	}
 	fd[0] = fd0;
 	fd[1] = fd1;
+	if(ucopy(ufd, fd, sizeof(fd)) < 0){
+		// Another thread may have closed the fds already.
+		if(fdtremove(myproc()->fdt, fd0, rf) == 0)
+			fileclose(rf);
+		if(fdtremove(myproc()->fdt, fd1, wf) == 0)
+			fileclose(wf);
+		return -1;
+	}
 	return 0;
 }
+
+// void *mmap(void *addr, uint len, int prot, int flags, int fd, int off)
+// addr is only a hint and is ignored; the kernel picks the address.
+int
+sys_mmap(void)
+{
+	int len, prot, flags, off;
+	struct file *f;
+
+	if(argint(1, &len) < 0 || argint(2, &prot) < 0 ||
+	   argint(3, &flags) < 0 || argint(5, &off) < 0)
+		return -1;
+	if(off < 0)
+		return -1;
+	f = 0;
+	if(!(flags & MAP_ANONYMOUS) && argfd(4, 0, &f) < 0)
+		return -1;
+	// mmap() takes its own reference for the mapping.
+	len = mmap(len, prot, flags, f, off);
+	if(f)
+		fileclose(f);
+	return len;
+}
+
+int
+sys_munmap(void)
+{
+	int addr, len;
+
+	if(argint(0, &addr) < 0 || argint(1, &len) < 0)
+		return -1;
+	return munmap(addr, len);
+}
@@ -6,6 +6,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "pstat.h"
 
 int
 sys_fork(void)
@@ -13,6 +14,56 @@ sys_fork(void)
 	return fork();
 }
 
+// int futex(int *addr, int op, int val)
+// FUTEX_WAIT: sleep until woken, if *addr still holds val.
+// FUTEX_WAKE: wake up to val processes waiting on addr; returns
+// how many. Waiters are keyed by the physical word, so threads
+// and processes sharing a MAP_SHARED page find each other.
+int
+sys_futex(void)
+{
+	int *uaddr, *key;
+	int op, val;
+	char *page;
+
+	if(argptr(0, (char**)&uaddr, sizeof(*uaddr)) < 0 ||
+	   argint(1, &op) < 0 || argint(2, &val) < 0)
+		return -1;
+	if((uint)uaddr % sizeof(*uaddr) != 0)
+		return -1;
+	if((page = uva2ka(myproc()->pgdir, (char*)uaddr)) == 0)
+		return -1;
+	key = (int*)(page + ((uint)uaddr % PGSIZE));
+	return futex(key, op, val);
+}
+
+// int clone(void (*fn)(void*), void *arg, void *stack)
+int
+sys_clone(void)
+{
+	int fn, arg, stack;
+
+	if(argint(0, &fn) < 0 || argint(1, &arg) < 0 || argint(2, &stack) < 0)
+		return -1;
+	return clone(fn, arg, stack);
+}
+
+// int join(int tid, void **stack)
+int
+sys_join(void)
+{
+	int tid, pid;
+	uint *ustack, stack;
+
+	if(argint(0, &tid) < 0 || argptrw(1, (char**)&ustack, sizeof(stack)) < 0)
+		return -1;
+	if((pid = join(tid, &stack)) < 0)
+		return -1;
+	if(ucopy(ustack, &stack, sizeof(stack)) < 0)
+		return -1;
+	return pid;
+}
+
 int
 sys_exit(void)
 {
@@ -36,6 +87,41 @@ sys_kill(void)
 	return kill(pid);
 }
 
+// int nice(int pid, int value)
+// Returns the old niceness.
+int
+sys_nice(void)
+{
+	int pid, value;
+
+	if(argint(0, &pid) < 0 || argint(1, &value) < 0)
+		return -1;
+	return setnice(pid, value);
+}
+
+int
+sys_affinity(void)
+{
+	int pid, mask;
+
+	if(argint(0, &pid) < 0 || argint(1, &mask) < 0)
+		return -1;
+	return setaffinity(pid, mask);
+}
+
+int
+sys_getpstat(void)
+{
+	int pid;
+	struct pstat *ups, ps;
+
+	if(argint(0, &pid) < 0 || argptrw(1, (char**)&ups, sizeof(ps)) < 0)
+		return -1;
+	if(procstat(pid, &ps) < 0)
+		return -1;
+	return ucopy(ups, &ps, sizeof(ps));
+}
+
 int
 sys_getpid(void)
 {
@@ -56,27 +142,63 @@ sys_sbrk(void)
 	return addr;
 }
 
-int
-sys_sleep(void)
+// Sleep for n ticks, on the timer wheel.
+static int
+sleepticks(int n)
 {
-	int n;
+	struct proc *p = myproc();
 	uint ticks0;
 
-	if(argint(0, &n) < 0)
-		return -1;
 	acquire(&tickslock);
 	ticks0 = ticks;
+	if(n > 0)
+		settimer(&p->timer, ticks0 + n, &p->timer);
 	while(ticks - ticks0 < n){
-		if(myproc()->killed){
+		if(p->killed){
+			canceltimer(&p->timer);
 			release(&tickslock);
 			return -1;
 		}
-		sleep(&ticks, &tickslock);
+		sleep(&p->timer, &tickslock);
 	}
+	canceltimer(&p->timer);
 	release(&tickslock);
 	return 0;
 }
 
+int
+sys_sleep(void)
+{
+	int n;
+
+	if(argint(0, &n) < 0)
+		return -1;
+	return sleepticks(n);
+}
+
+// int usleep(uint usec)
+// Sleep for usec microseconds. Whole ticks are slept on the
+// timer wheel, as long as that cannot overshoot; sleeptsc()
+// waits out the rest with a one-shot timer.
+int
+sys_usleep(void)
+{
+	int usec;
+	uint tickus;
+	uint64 end;
+
+	if(argint(0, &usec) < 0)
+		return -1;
+	tickus = 1000000 / HZ;
+	if(tscperus == 0)  // no LAPIC: whole ticks only
+		return sleepticks(((uint)usec + tickus - 1) / tickus + 1);
+	end = rdtsc() + (uint64)(uint)usec * tscperus;
+	// A sleep of n ticks lasts between n-1 and n ticks.
+	if((uint)usec / tickus > 1 && sleepticks((uint)usec / tickus - 1) < 0)
+		return -1;
+	return sleeptsc(end);
+}
+
 // return how many clock tick interrupts have occurred
 // since start.
 int
@@ -0,0 +1,98 @@
+//
+// Timer wheel: wake up a channel at a given tick.
+//
+// Pending timers hang off wheel[expires % NWHEEL], so the clock
+// tick only looks at the one slot for the current tick, and a
+// sleep() of any length costs nothing until it is due. Timers
+// more than NWHEEL ticks away stay in their slot for another lap.
+// Everything here is protected by tickslock.
+//
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+
+#define NWHEEL 64
+
+static struct timer *wheel[NWHEEL];
+
+// Arrange for wakeup(chan) at tick expires.
+// Caller must hold tickslock.
+void
+settimer(struct timer *t, uint expires, void *chan)
+{
+	struct timer **slot;
+
+	canceltimer(t);
+	t->expires = expires;
+	t->chan = chan;
+	slot = &wheel[expires % NWHEEL];
+	t->next = *slot;
+	if(t->next)
+		t->next->prev = &t->next;
+	t->prev = slot;
+	*slot = t;
+
+	// A tickless CPU 0 has to set its timer for this one.
+	if(cpus[0].tickless)
+		kick(&cpus[0]);
+}
+
+// Take t off the wheel, if it is still pending.
+// Caller must hold tickslock.
+void
+canceltimer(struct timer *t)
+{
+	if(t->prev == 0)
+		return;
+	*t->prev = t->next;
+	if(t->next)
+		t->next->prev = t->prev;
+	t->prev = 0;
+}
+
+// The clock went from tick old to now: fire the timers
+// that have come due.
+// Caller must hold tickslock.
+void
+timerexpire(uint old, uint now)
+{
+	struct timer *t, *next;
+	uint i;
+
+	if(now - old > NWHEEL)
+		old = now - NWHEEL;
+	for(i = old+1; i != now+1; i++){
+		for(t = wheel[i % NWHEEL]; t; t = next){
+			next = t->next;
+			if((int)(t->expires - now) <= 0){
+				canceltimer(t);
+				wakeup(t->chan);
+			}
+		}
+	}
+}
+
+// Ticks from now until the first pending timer,
+// or 0 if there is none.
+// Caller must hold tickslock.
+uint
+timernext(uint now)
+{
+	struct timer *t;
+	uint n, min;
+	int i;
+
+	min = 0;
+	for(i = 0; i < NWHEEL; i++){
+		for(t = wheel[i]; t; t = t->next){
+			n = (int)(t->expires - now) > 0 ? t->expires - now : 1;
+			if(min == 0 || n < min)
+				min = n;
+		}
+	}
+	return min;
+}
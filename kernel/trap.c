@@ -11,8 +11,10 @@
 // Interrupt descriptor table (shared by all CPUs).
 gatedesc idt[256];
 extern uint vectors[];  // in vectors.S: array of 256 entry pointers
+extern char ucopyfault[], ucopyend[];  // in ucopy.S
 struct spinlock tickslock;
 uint ticks;
+static uint idlecounts; // Tickless timer counts not yet in ticks
 
 void
 tvinit(void)
@@ -32,10 +34,169 @@ idtinit(void)
 	lidt(idt, sizeof(idt));
 }
 
+// Advance the clock by n ticks and fire the timers that
+// have come due. CPU 0 only.
+static void
+tick(uint n)
+{
+	uint old, now;
+
+	acquire(&tickslock);
+	old = ticks;
+	now = ticks += n;
+	timerexpire(old, now);
+	release(&tickslock);
+	if(now / BOOSTTICKS != old / BOOSTTICKS)
+		boost();
+}
+
+// Account for n timer counts that CPU 0 spent tickless.
+void
+clockadvance(uint n)
+{
+	idlecounts += n;
+	n = idlecounts / lapictick;
+	idlecounts %= lapictick;
+	if(n > 0)
+		tick(n);
+}
+
+// How many ticks CPU 0 may stay tickless: until the first
+// pending timer, or 0 if there is none.
+uint
+clocknext(void)
+{
+	uint n;
+
+	acquire(&tickslock);
+	n = timernext(ticks);
+	release(&tickslock);
+	return n;
+}
+
+// A CPU's timer normally ticks periodically. While a process
+// on it waits in sleeptsc(), each tick is instead cut into
+// one-shot pieces that end at the tick's end or at c->wakeat,
+// whichever comes first, so the sleeper wakes up on time and
+// the ticks keep their pace.
+
+#define TICKUS (1000000 / HZ)  // microseconds per tick
+
+// How many timer counts of the current tick have gone by.
+static uint
+timergone(struct cpu *c)
+{
+	uint left;
+
+	left = lapicleft();
+	if(c->shortarmed)
+		return c->shortspent + c->shortarmed - left;
+	if(left == 0 || left > lapictick)
+		return 0;
+	return lapictick - left;
+}
+
+// Set c's timer, with gone counts of the tick passed, to go off
+// at the end of the tick or at c->wakeat if that is sooner.
+// Called on c with interrupts off.
+static void
+timerarm(struct cpu *c, uint gone)
+{
+	uint n, w, us;
+	uint64 now;
+
+	if(gone >= lapictick)
+		gone = 0;
+	n = lapictick - gone;
+	if(c->wakeat){
+		now = rdtsc();
+		if(c->wakeat <= now)
+			n = 1;
+		else if(c->wakeat - now < (uint64)TICKUS * tscperus){
+			us = (uint)(c->wakeat - now) / tscperus;
+			w = us * (lapictick / TICKUS) +
+			    us * (lapictick % TICKUS) / TICKUS + 1;
+			if(w < n)
+				n = w;
+		}
+	}
+	if(gone == 0 && n == lapictick){
+		c->shortarmed = 0;
+		lapicperiodic();
+		return;
+	}
+	c->shortspent = gone;
+	c->shortarmed = n;
+	lapiconeshot(n);
+}
+
+// This CPU's timer went off. Wake sleeptsc() sleepers whose
+// deadline has come, and set the timer for what is next.
+// Returns 1 if a tick ended, 0 if only a piece of it did.
+static int
+timerintr(void)
+{
+	struct cpu *c = mycpu();
+	uint gone;
+	int ticked;
+
+	ticked = 1;
+	gone = 0;
+	if(c->shortarmed){
+		gone = timergone(c);
+		ticked = gone >= lapictick;
+	}
+	// A tickless CPU 0 accounts for the time itself in idle().
+	if(ticked && cpuid() == 0 && !c->tickless)
+		tick(1);
+	if(c->wakeat){
+		acquire(&tickslock);
+		if(rdtsc() >= c->wakeat){
+			c->wakeat = 0;
+			wakeup(&c->wakeat);
+		}
+		release(&tickslock);
+	}
+	if(c->shortarmed || c->wakeat)
+		timerarm(c, c->shortarmed ? gone : timergone(c));
+	return ticked;
+}
+
+// Sleep until the TSC reaches end, waking up from a one-shot
+// timer on this CPU rather than at the next tick.
+// Returns -1 if the process was killed.
+int
+sleeptsc(uint64 end)
+{
+	struct cpu *c;
+
+	acquire(&tickslock);
+	while(rdtsc() < end){
+		if(myproc()->killed){
+			release(&tickslock);
+			return -1;
+		}
+		c = mycpu();
+		if(c->wakeat == 0 || end < c->wakeat){
+			c->wakeat = end;
+			// A timer interrupt that is already pending
+			// sets the timer itself, and counts its tick.
+			if(!lapictimerpending())
+				timerarm(c, timergone(c));
+		}
+		sleep(&c->wakeat, &tickslock);
+	}
+	release(&tickslock);
+	return 0;
+}
+
 // Ovde se zapravo izvrsava sistemski poziv
 void
 trap(struct trapframe *tf)
 {
+	int ticked;
+	uint va;
+
 	// Proverava da li je sistemski poziv
 	if(tf->trapno == T_SYSCALL){
 		// Proverava da li je proces ubijen
@@ -48,14 +209,17 @@ trap(struct trapframe *tf)
 		return;
 	}
 
+	ticked = 0;
 	switch(tf->trapno){
 	case T_IRQ0 + IRQ_TIMER:
-		if(cpuid() == 0){
-			acquire(&tickslock);
-			ticks++;
-			wakeup(&ticks);
-			release(&tickslock);
-		}
+		ticked = timerintr();
+		lapiceoi();
+		break;
+	case T_IRQ0 + IRQ_WAKE:
+		lapiceoi();
+		break;
+	case T_IRQ0 + IRQ_TLB:
+		tlbflush();
 		lapiceoi();
 		break;
 	case T_IRQ0 + IRQ_IDE:
@@ -79,6 +243,28 @@ trap(struct trapframe *tf)
 			cpuid(), tf->cs, tf->eip);
 		lapiceoi();
 		break;
+	case T_PGFLT:
+		// A user access to an mmap() page that is not mapped yet,
+		// or a write to a private one that is not copied yet.
+		// The fault came in through an interrupt gate; turn
+		// interrupts back on, as for a system call, since copying
+		// the page may call tlbshootdown() and wait for the
+		// other CPUs. Read %cr2 first.
+		if(myproc() != 0 && (tf->cs&3) == DPL_USER){
+			va = rcr2();
+			sti();
+			if(mmapfault(va, tf->err) == 0)
+				break;
+			cli();
+		}
+		// ucopy() on user memory that another thread unmapped:
+		// make it return -1.
+		if((tf->cs&3) == 0 && rcr2() < KERNBASE &&
+		   tf->eip >= (uint)ucopy && tf->eip < (uint)ucopyend){
+			tf->eip = (uint)ucopyfault;
+			break;
+		}
+		// fall through
 
 	default:
 		if(myproc() == 0 || (tf->cs&3) == 0){
@@ -101,12 +287,12 @@ trap(struct trapframe *tf)
 	if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
 		exit();
 
-	// Force process to give up CPU on clock tick.
+	// Charge the clock tick to the running process, which gives
+	// up the CPU when its time slice is used up.
 	// If interrupts were on while locks held, would need to check nlock.
 	// Dajemo kontrolu procesora nekom drugom procesu
-	if(myproc() && myproc()->state == RUNNING &&
-			tf->trapno == T_IRQ0+IRQ_TIMER)
-		yield();
+	if(myproc() && myproc()->state == RUNNING && ticked)
+		proctick();
 
 	// Check if the process has been killed since we yielded
 	if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
@@ -34,5 +34,7 @@
 #define IRQ_COM1         4
 #define IRQ_IDE         14
 #define IRQ_ERROR       19
+#define IRQ_TLB         29      // IPI that flushes the TLB
+#define IRQ_WAKE        30      // IPI that wakes an idle CPU
 #define IRQ_SPURIOUS    31
 
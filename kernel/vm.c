@@ -6,6 +6,7 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "traps.h"
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
@@ -32,7 +33,7 @@ seginit(void)
 // Return the address of the PTE in page table pgdir
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page table pages.
-static pte_t *
+pte_t *
 walkpgdir(pde_t *pgdir, const void *va, int alloc)
 {
 	pde_t *pde;
@@ -42,10 +43,9 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
 	if(*pde & PTE_P){
 		pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
 	} else {
-		if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
-			return 0;
 		// Make sure all those PTE_P bits are zero.
-		memset(pgtab, 0, PGSIZE);
+		if(!alloc || (pgtab = (pte_t*)kzalloc()) == 0)
+			return 0;
 		// The permissions here are overly generous, but they can
 		// be further restricted by the permissions in the page table
 		// entries, if necessary.
@@ -60,7 +60,7 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
 //
 // Mapira stranice iz virtuelne u fizicke
 // Sa odredjenim permisijama
-static int
+int
 mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 {
 	char *a, *last;
@@ -93,6 +93,41 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 	return 0;
 }
 
+// Like mappages, but maps every PTSIZE-aligned stretch of the range
+// with a single 4 Mbyte page (PTE_PS) straight from the page directory,
+// so no page table pages are needed for it. The unaligned head and
+// tail of the range fall back to ordinary 4 Kbyte pages.
+// Used only for the kernel's mappings, which are identical in every
+// page directory and never change, so they are all marked PTE_G
+// and stay in the TLB across %cr3 loads. CR4_PSE and CR4_PGE are
+// set by entry.S and entryother.S.
+static int
+mapkpages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
+{
+	uint a, last, n;
+
+	perm |= PTE_G;
+	a = (uint)va;
+	last = a + size;  // wraps to 0 for the DEVSPACE mapping
+	while(a != last){
+		if(a % PTSIZE == 0 && pa % PTSIZE == 0 && last - a >= PTSIZE){
+			if(pgdir[PDX(a)] & PTE_P)
+				panic("remap");
+			pgdir[PDX(a)] = pa | perm | PTE_P | PTE_PS;
+			n = PTSIZE;
+		} else {
+			n = PTSIZE - a % PTSIZE;
+			if(n > last - a)
+				n = last - a;
+			if(mappages(pgdir, (void*)a, n, pa, perm) < 0)
+				return -1;
+		}
+		a += n;
+		pa += n;
+	}
+	return 0;
+}
+
 // There is one page table per process, plus one that's used when
 // a CPU is not running any process (kpgdir). The kernel uses the
 // current process's page table during system calls and interrupts;
@@ -110,6 +145,12 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 //                                  rw data + free physical memory
 //   0xfe000000..0: mapped direct (devices such as ioapic)
 //
+// Wherever these regions are 4 Mbyte aligned they are mapped with
+// 4 Mbyte pages (see mapkpages), which leaves only the first
+// 4 Mbytes of the kernel (I/O space, text and the start of data)
+// needing a page table page. That page is built once by kvmalloc()
+// and shared by every page directory.
+//
 // The kernel allocates physical memory for its heap and for user memory
 // between V2P(end) and the end of physical memory (PHYSTOP)
 // (directly addressable from end..P2V(PHYSTOP)).
@@ -129,32 +170,39 @@ static struct kmap {
 };
 
 // Set up kernel part of a page table.
+// The kernel half of every page directory is a copy of kpgdir's,
+// so all of them share kpgdir's page table pages instead of each
+// building its own; see kvmalloc.
 pde_t*
 setupkvm(void)
 {
 	pde_t *pgdir;
-	struct kmap *k;
 
-	if((pgdir = (pde_t*)kalloc()) == 0)
+	if((pgdir = (pde_t*)kzalloc()) == 0)
 		return 0;
-	memset(pgdir, 0, PGSIZE);
-	if (P2V(PHYSTOP) > (void*)DEVSPACE)
-		panic("PHYSTOP too high");
-	for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-		if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-		            (uint)k->phys_start, k->perm) < 0) {
-			freevm(pgdir);
-			return 0;
-		}
+	memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+	        (NPDENTRIES - PDX(KERNBASE)) * sizeof(pde_t));
 	return pgdir;
 }
 
 // Allocate one page table for the machine for the kernel address
-// space for scheduler processes.
+// space for scheduler processes. Its kernel mappings, and the
+// page table pages behind them, are built only here and are
+// shared by every page directory that setupkvm() creates.
+// They never change afterwards.
 void
 kvmalloc(void)
 {
-	kpgdir = setupkvm();
+	struct kmap *k;
+
+	if((kpgdir = (pde_t*)kzalloc()) == 0)
+		panic("kvmalloc");
+	if (P2V(PHYSTOP) > (void*)DEVSPACE)
+		panic("PHYSTOP too high");
+	for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
+		if(mapkpages(kpgdir, k->virt, k->phys_end - k->phys_start,
+		             (uint)k->phys_start, k->perm) < 0)
+			panic("kvmalloc: out of memory");
 	switchkvm();
 }
 
@@ -191,6 +239,56 @@ switchuvm(struct proc *p)
 	popcli();
 }
 
+// Flush this CPU's TLB, answering every tlbshootdown()
+// asked of it so far.
+void
+tlbflush(void)
+{
+	struct cpu *c;
+	uint req;
+
+	pushcli();
+	c = mycpu();
+	req = c->tlbreq;
+	lcr3(rcr3());
+	c->tlbdone = req;
+	popcli();
+}
+
+// Pages have just been unmapped from pgdir, which threads may be
+// using on other CPUs. Flush this CPU's TLB, and those of the CPUs
+// running a process with pgdir, waiting until they are done, so
+// that the pages can be freed. Call with interrupts enabled and no
+// spinlocks held: the other CPUs may be waiting for this one.
+void
+tlbshootdown(pde_t *pgdir)
+{
+	struct cpu *c, *me;
+	struct proc *p;
+	uint want[NCPU];
+	int i;
+
+	pushcli();
+	me = mycpu();
+	// The PTE changes must be visible before we look at c->proc:
+	// a CPU that switches to pgdir later loads %cr3 after that.
+	__sync_synchronize();
+	for(i = 0; i < ncpu; i++){
+		c = &cpus[i];
+		want[i] = 0;
+		if(c == me || (p = c->proc) == 0 || p->pgdir != pgdir)
+			continue;
+		want[i] = __sync_add_and_fetch(&c->tlbreq, 1);
+		lapicipi(c->apicid, T_IRQ0 + IRQ_TLB);
+	}
+	popcli();
+	tlbflush();
+	for(i = 0; i < ncpu; i++)
+		if(want[i] != 0)
+			while((int)(cpus[i].tlbdone - want[i]) < 0)
+				;
+}
+
 // Load the initcode into address 0 of pgdir.
 // sz must be less than a page.
 void
@@ -201,8 +299,7 @@ inituvm(pde_t *pgdir, char *init, uint sz)
 	if(sz >= PGSIZE)
 		panic("inituvm: more than a page");
 	// Alocira jednu stranicu u memoriji i prazni je
-	mem = kalloc();
-	memset(mem, 0, PGSIZE);
+	mem = kzalloc();
 	// Ubacujemo je u pgdir i mapiramo u page direktory
 	// Treba da bude zapisiva i treba da bude user
 	// Ovo je najosnovnija upotreba mappages-a, koja nam treba
@@ -258,16 +355,14 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 	// Idemo od stranice koja nam treba
 	// Do nove stranice, stranicu po stranicu
 	for(; a < newsz; a += PGSIZE){
-		// Alociramo novu stranicu
-		mem = kalloc();
+		// Alociramo novu, vec ispraznjenu stranicu
+		mem = kzalloc();
 		if(mem == 0){
 			cprintf("allocuvm out of memory\n");
 			// Cleanup u slucaju greske
 			deallocuvm(pgdir, newsz, oldsz);
 			return 0;
 		}
-		// Ispraznimo je
-		memset(mem, 0, PGSIZE);
 		// Mapiramo je u page dir na adresu a sto je trenutni itr (sl stranica)
 		// Mapiramo jednu stranicu
 		// I opet ovaj alocirani mem, pretvoren u fizicku adresu
@@ -313,8 +408,40 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 	return newsz;
 }
 
+// Like deallocuvm(), for the page table of a process that may
+// have threads on other CPUs: the pages are unmapped first, and
+// only freed once no TLB can reach them.
+int
+shrinkuvm(pde_t *pgdir, uint oldsz, uint newsz)
+{
+	pte_t *pte;
+	uint a;
+
+	if(newsz >= oldsz)
+		return oldsz;
+	for(a = PGROUNDUP(newsz); a < oldsz; a += PGSIZE){
+		pte = walkpgdir(pgdir, (char*)a, 0);
+		if(!pte)
+			a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+		else
+			*pte &= ~PTE_P;  // keep the address for below
+	}
+	tlbshootdown(pgdir);
+	for(a = PGROUNDUP(newsz); a < oldsz; a += PGSIZE){
+		pte = walkpgdir(pgdir, (char*)a, 0);
+		if(!pte)
+			a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+		else if(PTE_ADDR(*pte) != 0){
+			kfree(P2V(PTE_ADDR(*pte)));
+			*pte = 0;
+		}
+	}
+	return newsz;
+}
+
 // Free a page table and all the physical memory pages
-// in the user part.
+// in the user part. The kernel part is shared with kpgdir
+// and is left alone.
 void
 freevm(pde_t *pgdir)
 {
@@ -322,8 +449,10 @@ freevm(pde_t *pgdir)
 
 	if(pgdir == 0)
 		panic("freevm: no pgdir");
+	if(pgdir == kpgdir)
+		panic("freevm: kpgdir");
 	deallocuvm(pgdir, KERNBASE, 0);
-	for(i = 0; i < NPDENTRIES; i++){
+	for(i = 0; i < PDX(KERNBASE); i++){
 		if(pgdir[i] & PTE_P){
 			char * v = P2V(PTE_ADDR(pgdir[i]));
 			kfree(v);
@@ -140,12 +140,38 @@ lcr3(uint val)
 	asm volatile("movl %0,%%cr3" : : "r" (val));
 }
 
+static inline uint
+rcr3(void)
+{
+	uint val;
+	asm volatile("movl %%cr3,%0" : "=r" (val));
+	return val;
+}
+
+static inline uint64
+rdtsc(void)
+{
+	uint64 t;
+
+	asm volatile("rdtsc" : "=A" (t));
+	return t;
+}
+
 static inline void
 hlt(void)
 {
 	asm volatile("hlt");
 }
 
+// Enable interrupts and halt. An interrupt that is already pending
+// still ends the hlt, since sti only takes effect after the next
+// instruction.
+static inline void
+stihlt(void)
+{
+	asm volatile("sti; hlt");
+}
+
 // Layout of the trap frame built on the stack by the
 // hardware and by trapasm.S, and passed to trap().
 struct trapframe {
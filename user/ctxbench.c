@@ -0,0 +1,58 @@
+// Context switch microbenchmark.
+// A parent and a child bounce one byte back and forth over
+// two pipes, so every round trip forces at least two context
+// switches (on a single CPU, make qemu CPUS=1).
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user.h"
+
+#define N  20000
+
+int
+main(int argc, char *argv[])
+{
+	int ping[2], pong[2];
+	int i, n, pid, start, elapsed;
+	char c;
+
+	n = N;
+	if(argc > 1)
+		n = atoi(argv[1]);
+
+	if(pipe(ping) < 0 || pipe(pong) < 0){
+		printf("ctxbench: pipe failed\n");
+		exit();
+	}
+
+	pid = fork();
+	if(pid < 0){
+		printf("ctxbench: fork failed\n");
+		exit();
+	}
+	if(pid == 0){
+		close(ping[1]);
+		close(pong[0]);
+		while(read(ping[0], &c, 1) == 1)
+			write(pong[1], &c, 1);
+		exit();
+	}
+	close(ping[0]);
+	close(pong[1]);
+
+	c = 'x';
+	start = uptime();
+	for(i = 0; i < n; i++){
+		if(write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1){
+			printf("ctxbench: round trip %d failed\n", i);
+			break;
+		}
+	}
+	elapsed = uptime() - start;
+	close(ping[1]);
+	wait();
+
+	printf("ctxbench: %d round trips (%d switches) in %d ticks\n",
+	       i, 2*i, elapsed);
+	exit();
+}
@@ -1,11 +1,13 @@
 // Test that fork fails gracefully.
 // Tiny executable so that the limit can be filling the proc table.
 
+#include "kernel/param.h"
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "user.h"
 
-#define N  1000
+// More than the proc table holds.
+#define N  NPROC
 
 // forktest is not linked against printf.o, so we have our own.
 void
@@ -2,16 +2,50 @@
 
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/mman.h"
 #include "user.h"
 
 char buf[1024];
 int match(char*, char*);
 
+// Print the '\n'-terminated lines of p[0..n-1] that match.
+// Each line is NUL-terminated in place while it is matched.
+void
+grepmap(char *pattern, char *p, int n)
+{
+	char *q, *e;
+
+	e = p + n;
+	for(q = p; q < e; q++){
+		if(*q != '\n')
+			continue;
+		*q = 0;
+		if(match(pattern, p)){
+			*q = '\n';
+			fwrite(1, p, q+1 - p);
+		}
+		*q = '\n';
+		p = q+1;
+	}
+}
+
 void
 grep(char *pattern, int fd)
 {
 	int n, m;
 	char *p, *q;
+	struct stat st;
+
+	// Map regular files privately: no copying through buf, and
+	// no limit on line length.
+	if(fstat(fd, &st) == 0 && st.type == T_FILE && st.size > 0){
+		p = mmap(0, st.size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if(p != MAP_FAILED){
+			grepmap(pattern, p, st.size);
+			munmap(p, st.size);
+			return;
+		}
+	}
 
 	m = 0;
 	while((n = read(fd, buf+m, sizeof(buf)-m-1)) > 0){
@@ -22,7 +56,7 @@ grep(char *pattern, int fd)
 			*q = 0;
 			if(match(pattern, p)){
 				*q = '\n';
-				write(1, p, q+1 - p);
+				fwrite(1, p, q+1 - p);
 			}
 			p = q+1;
 		}
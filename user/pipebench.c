@@ -0,0 +1,70 @@
+// Pipe throughput benchmark.
+// A child writes kb kilobytes into a pipe, bufsize bytes per
+// write(), and the parent reads them back in the same size;
+// run it again with other sizes to see how the cost per call
+// compares with the cost per byte.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user.h"
+
+#define KB       4096
+#define BUFSIZE  4096
+
+char buf[8192];
+
+int
+main(int argc, char *argv[])
+{
+	int fds[2];
+	int kb, bufsize, pid, n, start, elapsed;
+	uint total, left;
+
+	kb = KB;
+	bufsize = BUFSIZE;
+	if(argc > 1)
+		kb = atoi(argv[1]);
+	if(argc > 2)
+		bufsize = atoi(argv[2]);
+	if(bufsize <= 0 || bufsize > sizeof(buf)){
+		printf("pipebench: buffer size must be 1 to %d\n", sizeof(buf));
+		exit();
+	}
+
+	if(pipe(fds) < 0){
+		printf("pipebench: pipe failed\n");
+		exit();
+	}
+	total = kb * 1024;
+
+	start = uptime();
+	pid = fork();
+	if(pid < 0){
+		printf("pipebench: fork failed\n");
+		exit();
+	}
+	if(pid == 0){
+		close(fds[0]);
+		for(left = total; left > 0; left -= n){
+			n = left < bufsize ? left : bufsize;
+			if(write(fds[1], buf, n) != n){
+				printf("pipebench: write failed\n");
+				break;
+			}
+		}
+		exit();
+	}
+	close(fds[1]);
+	left = total;
+	while(left > 0 && (n = read(fds[0], buf, bufsize)) > 0)
+		left -= n;
+	elapsed = uptime() - start;
+	close(fds[0]);
+	wait();
+
+	if(left != 0)
+		printf("pipebench: %d bytes missing\n", left);
+	printf("pipebench: %d KB in %d-byte writes: %d ticks\n",
+	       kb, bufsize, elapsed);
+	exit();
+}
@@ -1,19 +1,74 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/uio.h"
 #include "user.h"
 
 #include <stdarg.h>
 
 static char digits[] = "0123456789ABCDEF";
 
+// The output of one vprintf(), passed to fwritev() in one go
+// unless it has too many pieces: runs of the format and %s strings
+// are pointed to where they are, converted numbers and characters
+// are kept in buf.
+struct out {
+	int fd;
+	struct iovec iov[IOV_MAX];
+	int niov;
+	char buf[64];
+	int nbuf;
+};
+
+static void
+flush(struct out *o)
+{
+	if(o->niov > 0)
+		fwritev(o->fd, o->iov, o->niov);
+	o->niov = 0;
+	o->nbuf = 0;
+}
+
+// Add the n bytes at s to the output.
+static void
+put(struct out *o, const char *s, int n)
+{
+	struct iovec *v;
+
+	if(n == 0)
+		return;
+	if(o->niov > 0){
+		v = &o->iov[o->niov-1];
+		if((char*)v->iov_base + v->iov_len == s){
+			v->iov_len += n;
+			return;
+		}
+	}
+	if(o->niov == IOV_MAX)
+		flush(o);
+	o->iov[o->niov].iov_base = (void*)s;
+	o->iov[o->niov].iov_len = n;
+	o->niov++;
+}
+
+// Add a copy of the n bytes at s, at most sizeof(o->buf).
+static void
+putcopy(struct out *o, const char *s, int n)
+{
+	if(o->nbuf + n > sizeof(o->buf) || o->niov == IOV_MAX)
+		flush(o);
+	memmove(o->buf + o->nbuf, s, n);
+	put(o, o->buf + o->nbuf, n);
+	o->nbuf += n;
+}
+
 static void
-putc(int fd, char c)
+putc(struct out *o, char c)
 {
-	write(fd, &c, 1);
+	putcopy(o, &c, 1);
 }
 
 static void
-printint(int fd, int xx, int base, int sgn)
+printint(struct out *o, int xx, int base, int sgn)
 {
 	char buf[16];
 	int i, neg;
@@ -27,24 +82,27 @@ printint(int fd, int xx, int base, int sgn)
 		x = xx;
 	}
 
-	i = 0;
+	i = sizeof(buf);
 	do{
-		buf[i++] = digits[x % base];
+		buf[--i] = digits[x % base];
 	}while((x /= base) != 0);
 	if(neg)
-		buf[i++] = '-';
+		buf[--i] = '-';
 
-	while(--i >= 0)
-		putc(fd, buf[i]);
+	putcopy(o, buf + i, sizeof(buf) - i);
 }
 
 // Print to the given fd. Only understands %d, %x, %p, %s.
 void
 vprintf(int fd, const char *fmt, va_list ap)
 {
+	struct out o;
 	char *s;
 	int c, i, state;
 
+	o.fd = fd;
+	o.niov = 0;
+	o.nbuf = 0;
 	state = 0;
 	for(i = 0; fmt[i]; i++){
 		c = fmt[i] & 0xff;
@@ -52,33 +110,30 @@ vprintf(int fd, const char *fmt, va_list ap)
 			if(c == '%'){
 				state = '%';
 			} else {
-				putc(fd, c);
+				put(&o, fmt + i, 1);
 			}
 		} else if(state == '%'){
 			if(c == 'd'){
-				printint(fd, va_arg(ap, int), 10, 1);
+				printint(&o, va_arg(ap, int), 10, 1);
 			} else if(c == 'x' || c == 'p') {
-				printint(fd, va_arg(ap, int), 16, 0);
+				printint(&o, va_arg(ap, int), 16, 0);
 			} else if(c == 's'){
 				s = va_arg(ap, char*);
 				if(s == 0)
 					s = "(null)";
-				while(*s != 0){
-					putc(fd, *s);
-					s++;
-				}
+				put(&o, s, strlen(s));
 			} else if(c == 'c'){
-				putc(fd, va_arg(ap, uint));
+				putc(&o, va_arg(ap, uint));
 			} else if(c == '%'){
-				putc(fd, c);
+				put(&o, fmt + i, 1);
 			} else {
 				// Unknown % sequence.  Print it to draw attention.
-				putc(fd, '%');
-				putc(fd, c);
+				put(&o, fmt + i - 1, 2);
 			}
 			state = 0;
 		}
 	}
+	flush(&o);
 }
 
 void
@@ -0,0 +1,124 @@
+// Scheduler benchmark with many runnable processes
+// (run with make qemu CPUS=4).
+// npairs pairs of processes bounce a byte over pipes, so the
+// run queues see a steady stream of wakeups from every CPU, while
+// nspin processes stay runnable all the time and keep the queues
+// long. Every process reports how often it was scheduled and how
+// often it moved between CPUs.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/pstat.h"
+#include "user.h"
+
+#define NPAIR   8
+#define NSPIN   16
+#define ROUNDS  2000
+
+void
+pingpong(int rounds)
+{
+	int ping[2], pong[2];
+	int i;
+	char c;
+
+	if(pipe(ping) < 0 || pipe(pong) < 0){
+		printf("schedbench: pipe failed\n");
+		exit();
+	}
+	if(fork() == 0){
+		close(ping[1]);
+		close(pong[0]);
+		while(read(ping[0], &c, 1) == 1)
+			write(pong[1], &c, 1);
+		exit();
+	}
+	close(ping[0]);
+	close(pong[1]);
+	c = 'x';
+	for(i = 0; i < rounds; i++)
+		if(write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1)
+			break;
+	close(ping[1]);
+	wait();
+}
+
+volatile int sink;
+
+void
+spin(int loops)
+{
+	int i, j;
+
+	for(i = 0; i < loops; i++)
+		for(j = 0; j < 100000; j++)
+			sink += j;
+}
+
+// Send this process's scheduling statistics down fd.
+void
+report(int fd)
+{
+	struct pstat ps;
+
+	if(getpstat(0, &ps) == 0)
+		write(fd, &ps, sizeof(ps));
+}
+
+int
+main(int argc, char *argv[])
+{
+	int i, n, npair, nspin, rounds, start, elapsed;
+	int stats[2];
+	uint runs, migrations;
+	struct pstat ps;
+
+	npair = NPAIR;
+	nspin = NSPIN;
+	rounds = ROUNDS;
+	if(argc > 1)
+		npair = atoi(argv[1]);
+	if(argc > 2)
+		nspin = atoi(argv[2]);
+	if(argc > 3)
+		rounds = atoi(argv[3]);
+
+	if(pipe(stats) < 0){
+		printf("schedbench: pipe failed\n");
+		exit();
+	}
+	start = uptime();
+	n = 0;
+	for(i = 0; i < npair + nspin; i++){
+		switch(fork()){
+		case -1:
+			printf("schedbench: fork failed\n");
+			break;
+		case 0:
+			if(i < npair)
+				pingpong(rounds);
+			else
+				spin(rounds / 20);
+			report(stats[1]);
+			exit();
+		default:
+			n++;
+		}
+	}
+	// Drain the reports as they come, so that a full pipe
+	// does not hold up exiting children.
+	close(stats[1]);
+	runs = migrations = 0;
+	while(read(stats[0], &ps, sizeof(ps)) == sizeof(ps)){
+		runs += ps.runs;
+		migrations += ps.migrations;
+	}
+	while(n-- > 0)
+		wait();
+	elapsed = uptime() - start;
+
+	printf("schedbench: %d pairs x %d round trips, %d spinners: %d ticks\n",
+	       npair, rounds, nspin, elapsed);
+	printf("schedbench: %d runs, %d migrations\n", runs, migrations);
+	exit();
+}
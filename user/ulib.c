@@ -1,8 +1,11 @@
 #include "kernel/types.h"
+#include "kernel/param.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/uio.h"
 #include "user.h"
 #include "kernel/x86.h"
+#include "kernel/futex.h"
 
 char*
 strcpy(char *s, const char *t)
@@ -77,16 +80,187 @@ strchr(const char *s, char c)
 	return 0;
 }
 
+// Buffered output. Each fd below NOFILE has a buffer that is
+// written out when it fills up, at exit(), and before fork() and
+// exec() so that the output is neither lost nor written twice,
+// and before close() and dup() so that it reaches the right file
+// in the right order.
+// Output to the console is also written at each newline and
+// before gets() waits for input; fd 2 is not buffered at all.
+// The buffers are not locked: threads must not share an fd, and
+// a thread ends with _exit() so as not to flush the others' output.
+#define BUFSIZ 512
+
+enum { OUNSET, ONONE, OLINE, OFULL };
+
+static struct {
+	int mode;           // OUNSET until the first write to the fd
+	int n;
+	char buf[BUFSIZ];
+} obuf[NOFILE];
+
+// Input buffer for gets(), which reads fd 0.
+static struct {
+	int off;
+	int n;
+	char buf[BUFSIZ];
+} ibuf;
+
+// How output to fd should be buffered. fwritev() asks once per
+// fd and keeps the answer until close() or dup() may change it.
+static int
+omode(int fd)
+{
+	struct stat st;
+
+	if(fd == 2)
+		return ONONE;
+	if(fstat(fd, &st) == 0 && st.type == T_DEV)
+		return OLINE;
+	return OFULL;
+}
+
+// Write out the buffered output for fd, or for all fds if fd < 0.
+// What write() does not take stays buffered, for a later call to
+// retry: write() may return -EAGAIN or a short count if fd is
+// O_NONBLOCK. Returns 0, the error write() returned, or -1 for a
+// short write.
+int
+fflush(int fd)
+{
+	int n, r;
+
+	if(fd < 0){
+		r = 0;
+		for(fd = 0; fd < NOFILE; fd++)
+			if(obuf[fd].n > 0 && fflush(fd) < 0)
+				r = -1;
+		return r;
+	}
+	if(fd >= NOFILE || (n = obuf[fd].n) == 0)
+		return 0;
+	if((r = write(fd, obuf[fd].buf, n)) == n){
+		obuf[fd].n = 0;
+		return 0;
+	}
+	if(r > 0){
+		memmove(obuf[fd].buf, obuf[fd].buf + r, n - r);
+		obuf[fd].n = n - r;
+	}
+	return r < 0 ? r : -1;
+}
+
+// Buffered writev(). Returns the number of bytes taken, or the
+// error from fflush() if they do not fit in the buffer.
+int
+fwritev(int fd, const struct iovec *iov, int cnt)
+{
+	int i, j, n, nl, r;
+	char *s;
+
+	if(fd < 0 || fd >= NOFILE || cnt < 0 || cnt > IOV_MAX)
+		return writev(fd, iov, cnt);
+	if(obuf[fd].mode == OUNSET)
+		obuf[fd].mode = omode(fd);
+	if(obuf[fd].mode == ONONE)
+		return writev(fd, iov, cnt);
+
+	n = nl = 0;
+	for(i = 0; i < cnt; i++){
+		n += iov[i].iov_len;
+		s = iov[i].iov_base;
+		for(j = 0; j < iov[i].iov_len && obuf[fd].mode == OLINE; j++)
+			if(s[j] == '\n')
+				nl = 1;
+	}
+	if(obuf[fd].n + n > BUFSIZ && (r = fflush(fd)) < 0)
+		return r;
+	if(n > BUFSIZ)
+		return writev(fd, iov, cnt);
+	for(i = 0; i < cnt; i++){
+		memmove(obuf[fd].buf + obuf[fd].n, iov[i].iov_base, iov[i].iov_len);
+		obuf[fd].n += iov[i].iov_len;
+	}
+	// The bytes are taken even if they cannot all be written yet.
+	if(nl)
+		fflush(fd);
+	return n;
+}
+
+// Buffered write().
+int
+fwrite(int fd, const void *p, int n)
+{
+	struct iovec iov;
+
+	iov.iov_base = (void*)p;
+	iov.iov_len = n;
+	return fwritev(fd, &iov, 1);
+}
+
+int
+fork(void)
+{
+	fflush(-1);
+	return _fork();
+}
+
+int
+exit(void)
+{
+	fflush(-1);
+	_exit();
+}
+
+int
+exec(char *path, char **argv)
+{
+	fflush(-1);
+	return _exec(path, argv);
+}
+
+int
+close(int fd)
+{
+	fflush(fd);
+	// Whatever could not be written must not go to the next
+	// file that gets this fd.
+	if(fd >= 0 && fd < NOFILE){
+		obuf[fd].n = 0;
+		obuf[fd].mode = OUNSET;
+	}
+	return _close(fd);
+}
+
+int
+dup(int fd)
+{
+	int r;
+
+	fflush(fd);
+	if((r = _dup(fd)) >= 0 && r < NOFILE)
+		obuf[r].mode = OUNSET;
+	return r;
+}
+
+// Read a line from fd 0, through ibuf.
 char*
 gets(char *buf, int max)
 {
-	int i, cc;
+	int i;
 	char c;
 
 	for(i=0; i+1 < max; ){
-		cc = read(0, &c, 1);
-		if(cc < 1)
-			break;
+		if(ibuf.off == ibuf.n){
+			// Show any prompt before waiting.
+			fflush(-1);
+			ibuf.off = 0;
+			if((ibuf.n = read(0, ibuf.buf, sizeof(ibuf.buf))) < 1){
+				ibuf.n = 0;
+				break;
+			}
+		}
+		c = ibuf.buf[ibuf.off++];
 		buf[i++] = c;
 		if(c == '\n' || c == '\r')
 			break;
@@ -132,3 +306,71 @@ memmove(void *vdst, const void *vsrc, int n)
 		*dst++ = *src++;
 	return vdst;
 }
+
+void
+mutex_init(struct mutex *m)
+{
+	m->state = 0;
+}
+
+// Uncontended lock and unlock stay in user space; only a thread
+// that finds the mutex held enters the kernel, after marking the
+// mutex contended so that the holder knows to wake it.
+void
+mutex_lock(struct mutex *m)
+{
+	int c;
+
+	if((c = __sync_val_compare_and_swap(&m->state, 0, 1)) == 0)
+		return;
+	if(c != 2)
+		c = __sync_lock_test_and_set(&m->state, 2);
+	while(c != 0){
+		futex(&m->state, FUTEX_WAIT, 2);
+		c = __sync_lock_test_and_set(&m->state, 2);
+	}
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+	if(__sync_fetch_and_sub(&m->state, 1) != 1){
+		m->state = 0;
+		futex(&m->state, FUTEX_WAKE, 1);
+	}
+}
+
+void
+cond_init(struct cond *c)
+{
+	c->seq = 0;
+}
+
+// Callers must recheck their condition in a loop:
+// wakeups may be spurious.
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+	int seq;
+
+	seq = c->seq;
+	mutex_unlock(m);
+	futex(&c->seq, FUTEX_WAIT, seq);
+	// Others may still be waiting, so take the mutex as contended.
+	while(__sync_lock_test_and_set(&m->state, 2) != 0)
+		futex(&m->state, FUTEX_WAIT, 2);
+}
+
+void
+cond_signal(struct cond *c)
+{
+	__sync_fetch_and_add(&c->seq, 1);
+	futex(&c->seq, FUTEX_WAKE, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+	__sync_fetch_and_add(&c->seq, 1);
+	futex(&c->seq, FUTEX_WAKE, 0x7fffffff);
+}
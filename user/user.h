@@ -1,16 +1,30 @@
 struct stat;
 struct rtcdate;
+struct pstat;
+struct iovec;
+struct pollfd;
+
+// Futex-based locks, usable between threads and between processes
+// sharing a MAP_SHARED page.
+struct mutex {
+	volatile int state;   // 0 free, 1 locked, 2 locked with waiters
+};
+
+struct cond {
+	volatile int seq;     // bumped by every signal
+};
 
 // system calls
-int fork(void);
-int exit(void) __attribute__((noreturn));
+int _fork(void);
+int _exit(void) __attribute__((noreturn));
+int _exec(char*, char**);
+int _close(int);
+int _dup(int);
 int wait(void);
 int pipe(int*);
 int write(int, const void*, int);
 int read(int, void*, int);
-int close(int);
 int kill(int);
-int exec(char*, char**);
 int open(const char*, int);
 int mknod(const char*, short, short);
 int unlink(const char*);
@@ -18,14 +32,38 @@ int fstat(int fd, struct stat*);
 int link(const char*, const char*);
 int mkdir(const char*);
 int chdir(const char*);
-int dup(int);
 int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
 int symlink(const char* dest, const char* link);
+void* mmap(void*, uint, int, int, int, int);
+int munmap(void*, uint);
+int nice(int, int);
+int usleep(uint);
+int clone(void (*)(void*), void*, void*);
+int join(int, void**);
+int futex(volatile int*, int, int);
+int affinity(int, int);
+int getpstat(int, struct pstat*);
+int splice(int, int, int);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int lseek(int, int, int);
+int pread(int, void*, int, uint);
+int pwrite(int, const void*, int, uint);
+int poll(struct pollfd*, int, int);
+int fcntl(int, int, int);
 
 // ulib.c
+int fork(void);
+int exit(void) __attribute__((noreturn));
+int exec(char*, char**);
+int close(int);
+int dup(int);
+int fflush(int);
+int fwrite(int, const void*, int);
+int fwritev(int, const struct iovec*, int);
 int stat(const char*, struct stat*);
 char* strcpy(char*, const char*);
 char* strncpy(char*, const char*, int);
@@ -41,3 +79,14 @@ void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
 int atoi(const char*);
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
+
+// uthread.c
+int thread_create(void (*)(void*), void*);
+int thread_join(int);
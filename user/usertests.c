@@ -7,6 +7,11 @@
 #include "kernel/syscall.h"
 #include "kernel/traps.h"
 #include "kernel/memlayout.h"
+#include "kernel/mman.h"
+#include "kernel/futex.h"
+#include "kernel/pstat.h"
+#include "kernel/uio.h"
+#include "kernel/poll.h"
 
 char buf[8192];
 char name[3];
@@ -354,6 +359,474 @@ pipe1(void)
 	printf("pipe1 ok\n");
 }
 
+// splice() moves data from a file into a pipe and back.
+void
+splicetest(void)
+{
+	int fd, fds[2], i;
+
+	printf("splice test\n");
+	unlink("splicefile");
+	fd = open("splicefile", O_CREATE|O_RDWR);
+	if(fd < 0 || pipe(fds) < 0){
+		printf("splice: open or pipe failed\n");
+		exit();
+	}
+	for(i = 0; i < 3000; i++)
+		buf[i] = i;
+	if(write(fd, buf, 3000) != 3000){
+		printf("splice: write failed\n");
+		exit();
+	}
+	close(fd);
+
+	fd = open("splicefile", O_RDONLY);
+	if(splice(fd, fds[1], 10000) != 3000 || splice(fd, fds[1], 10000) != 0){
+		printf("splice: file to pipe failed\n");
+		exit();
+	}
+	close(fd);
+	memset(buf, 0, 3000);
+	if(read(fds[0], buf, 1000) != 1000){
+		printf("splice: read from pipe failed\n");
+		exit();
+	}
+	for(i = 0; i < 1000; i++){
+		if((buf[i] & 0xff) != (i & 0xff)){
+			printf("splice: wrong data in pipe\n");
+			exit();
+		}
+	}
+
+	// Splice the other 2000 bytes back into a new file.
+	unlink("splicefile");
+	fd = open("splicefile", O_CREATE|O_RDWR);
+	if(splice(fds[0], fd, 10000) != 2000){
+		printf("splice: pipe to file failed\n");
+		exit();
+	}
+	if(splice(fd, fd, 1) != -1 || splice(fds[0], fds[1], 1) != -1){
+		printf("splice: no pipe, or two, accepted\n");
+		exit();
+	}
+	close(fd);
+	close(fds[0]);
+	close(fds[1]);
+	fd = open("splicefile", O_RDONLY);
+	if(read(fd, buf, sizeof(buf)) != 2000){
+		printf("splice: wrong file size\n");
+		exit();
+	}
+	for(i = 0; i < 2000; i++){
+		if((buf[i] & 0xff) != ((i + 1000) & 0xff)){
+			printf("splice: wrong data in file\n");
+			exit();
+		}
+	}
+	close(fd);
+	unlink("splicefile");
+	printf("splice test ok\n");
+}
+
+// writev() gathers buffers into a file and readv() scatters
+// them back, split differently.
+void
+iovtest(void)
+{
+	struct iovec iov[IOV_MAX+1];
+	char a[6], b[300];
+	int fd, i;
+
+	printf("iov test\n");
+	unlink("iovfile");
+	if((fd = open("iovfile", O_CREATE|O_RDWR)) < 0){
+		printf("iov: open failed\n");
+		exit();
+	}
+	for(i = 0; i < 300; i++)
+		buf[i] = i;
+	iov[0].iov_base = "hello";
+	iov[0].iov_len = 5;
+	iov[1].iov_base = buf;
+	iov[1].iov_len = 0;
+	iov[2].iov_base = buf;
+	iov[2].iov_len = 300;
+	if(writev(fd, iov, 3) != 305){
+		printf("iov: writev failed\n");
+		exit();
+	}
+	for(i = 0; i <= IOV_MAX; i++){
+		iov[i].iov_base = buf;
+		iov[i].iov_len = 1;
+	}
+	if(writev(fd, iov, IOV_MAX+1) != -1 || writev(fd, iov, -1) != -1){
+		printf("iov: bad count accepted\n");
+		exit();
+	}
+	iov[0].iov_base = (void*)0xF0000000;
+	if(writev(fd, iov, 1) != -1){
+		printf("iov: bad buffer accepted\n");
+		exit();
+	}
+	close(fd);
+
+	fd = open("iovfile", O_RDONLY);
+	iov[0].iov_base = a;
+	iov[0].iov_len = 3;
+	iov[1].iov_base = a + 3;
+	iov[1].iov_len = 2;
+	iov[2].iov_base = b;
+	iov[2].iov_len = sizeof(b);
+	if(readv(fd, iov, 3) != 305){
+		printf("iov: readv failed\n");
+		exit();
+	}
+	a[5] = 0;
+	for(i = 0; i < 300; i++)
+		if(b[i] != buf[i])
+			break;
+	if(strcmp(a, "hello") != 0 || i < 300){
+		printf("iov: readv read wrong data\n");
+		exit();
+	}
+	close(fd);
+	unlink("iovfile");
+	printf("iov test ok\n");
+}
+
+// lseek() moves the offset; pread() and pwrite() ignore it.
+void
+seektest(void)
+{
+	int fd, fds[2], i;
+	char s[10];
+
+	printf("seek test\n");
+	unlink("seekfile");
+	if((fd = open("seekfile", O_CREATE|O_RDWR)) < 0){
+		printf("seek: open failed\n");
+		exit();
+	}
+	for(i = 0; i < 1000; i++)
+		buf[i] = i;
+	if(write(fd, buf, 1000) != 1000){
+		printf("seek: write failed\n");
+		exit();
+	}
+	if(lseek(fd, 500, SEEK_SET) != 500 || read(fd, s, 1) != 1 ||
+	   s[0] != buf[500]){
+		printf("seek: SEEK_SET failed\n");
+		exit();
+	}
+	if(lseek(fd, -10, SEEK_END) != 990 || lseek(fd, 0, SEEK_CUR) != 990){
+		printf("seek: SEEK_END or SEEK_CUR failed\n");
+		exit();
+	}
+	if(pread(fd, s, 10, 100) != 10 || s[0] != buf[100] || s[9] != buf[109]){
+		printf("seek: pread failed\n");
+		exit();
+	}
+	if(pwrite(fd, "xy", 2, 0) != 2 || pread(fd, s, 2, 0) != 2 ||
+	   s[0] != 'x' || s[1] != 'y'){
+		printf("seek: pwrite failed\n");
+		exit();
+	}
+	if(lseek(fd, 0, SEEK_CUR) != 990){
+		printf("seek: pread or pwrite moved the offset\n");
+		exit();
+	}
+	if(lseek(fd, -1, SEEK_SET) != -1 || lseek(fd, 0, 3) != -1){
+		printf("seek: bad offset accepted\n");
+		exit();
+	}
+	close(fd);
+	if(pipe(fds) < 0){
+		printf("pipe() failed\n");
+		exit();
+	}
+	if(lseek(fds[0], 0, SEEK_SET) != -1 || pread(fds[0], s, 1, 0) != -1){
+		printf("seek: pipe accepted an offset\n");
+		exit();
+	}
+	close(fds[0]);
+	close(fds[1]);
+	unlink("seekfile");
+	printf("seek test ok\n");
+}
+
+// O_NONBLOCK pipes return -EAGAIN instead of waiting.
+void
+nonblocktest(void)
+{
+	int fds[2], n, total;
+	char c;
+
+	printf("nonblock test\n");
+	if(pipe(fds) < 0){
+		printf("pipe() failed\n");
+		exit();
+	}
+	if(fcntl(fds[0], F_SETFL, O_NONBLOCK) < 0 ||
+	   fcntl(fds[1], F_SETFL, O_NONBLOCK) < 0 ||
+	   fcntl(fds[0], F_GETFL, 0) != (O_RDONLY|O_NONBLOCK) ||
+	   fcntl(fds[1], F_GETFL, 0) != (O_WRONLY|O_NONBLOCK)){
+		printf("nonblock: fcntl failed\n");
+		exit();
+	}
+	if(read(fds[0], &c, 1) != -EAGAIN){
+		printf("nonblock: read of an empty pipe did not fail\n");
+		exit();
+	}
+	total = 0;
+	while((n = write(fds[1], buf, sizeof(buf))) > 0)
+		total += n;
+	if(n != -EAGAIN || total == 0){
+		printf("nonblock: write to a full pipe returned %d after %d\n", n, total);
+		exit();
+	}
+	// Buffered output that cannot be written yet is kept.
+	if(fwrite(fds[1], "xyz", 3) != 3 || fflush(fds[1]) != -EAGAIN){
+		printf("nonblock: fflush to a full pipe did not fail\n");
+		exit();
+	}
+	while((n = read(fds[0], buf, sizeof(buf))) > 0)
+		total -= n;
+	if(n != -EAGAIN || total != 0){
+		printf("nonblock: read back %d too few bytes\n", total);
+		exit();
+	}
+	if(fflush(fds[1]) != 0 || read(fds[0], buf, sizeof(buf)) != 3 ||
+	   buf[0] != 'x' || buf[2] != 'z'){
+		printf("nonblock: buffered output lost\n");
+		exit();
+	}
+	close(fds[1]);
+	if(read(fds[0], &c, 1) != 0){
+		printf("nonblock: no end of file\n");
+		exit();
+	}
+	close(fds[0]);
+	printf("nonblock test ok\n");
+}
+
+// poll() waits on several pipes at once, and times out.
+void
+polltest(void)
+{
+	struct pollfd fds[3];
+	int a[2], b[2], pid, t0;
+	char c;
+
+	printf("poll test\n");
+	if(pipe(a) < 0 || pipe(b) < 0){
+		printf("pipe() failed\n");
+		exit();
+	}
+	fds[0].fd = a[0];
+	fds[0].events = POLLIN;
+	fds[1].fd = b[0];
+	fds[1].events = POLLIN;
+	fds[2].fd = b[1];
+	fds[2].events = POLLOUT;
+	if(poll(fds, 3, 0) != 1 || fds[0].revents || fds[1].revents ||
+	   fds[2].revents != POLLOUT){
+		printf("poll: wrong events on empty pipes\n");
+		exit();
+	}
+	t0 = uptime();
+	if(poll(fds, 2, 100) != 0 || uptime() - t0 < 100*HZ/1000 - 1){
+		printf("poll: timeout failed\n");
+		exit();
+	}
+	pid = fork();
+	if(pid < 0){
+		printf("fork failed\n");
+		exit();
+	}
+	if(pid == 0){
+		sleep(5);
+		write(b[1], "x", 1);
+		exit();
+	}
+	if(poll(fds, 2, -1) != 1 || fds[0].revents || fds[1].revents != POLLIN ||
+	   read(b[0], &c, 1) != 1 || c != 'x'){
+		printf("poll: no POLLIN from the second pipe\n");
+		exit();
+	}
+	wait();
+	close(a[1]);
+	fds[1].fd = -1;
+	fds[2].fd = a[1];
+	if(poll(fds, 3, -1) != 2 || fds[0].revents != POLLHUP || fds[1].revents ||
+	   fds[2].revents != POLLNVAL){
+		printf("poll: no POLLHUP or POLLNVAL\n");
+		exit();
+	}
+	close(a[0]);
+	close(b[0]);
+	close(b[1]);
+	printf("poll test ok\n");
+}
+
+// A process can open NOFILEMAX files, and gets the lowest free fd.
+void
+fdtest(void)
+{
+	int fd, i, last, pid;
+	char s[2];
+
+	printf("fd test\n");
+	unlink("fdfile");
+	if((fd = open("fdfile", O_CREATE|O_RDWR)) < 0 || write(fd, "ab", 2) != 2){
+		printf("fd: open failed\n");
+		exit();
+	}
+	last = fd;
+	while((i = dup(fd)) >= 0){
+		if(i != last+1){
+			printf("fd: dup returned %d after %d\n", i, last);
+			exit();
+		}
+		last = i;
+	}
+	if(last != NOFILEMAX-1){
+		printf("fd: only %d fds\n", last+1);
+		exit();
+	}
+	close(NOFILE+3);
+	if(dup(fd) != NOFILE+3){
+		printf("fd: lowest fd not reused\n");
+		exit();
+	}
+	pid = fork();
+	if(pid < 0){
+		printf("fork failed\n");
+		exit();
+	}
+	if(pid == 0){
+		if(pread(last, s, 2, 0) != 2 || s[0] != 'a' || s[1] != 'b'){
+			printf("fd: child cannot read fd %d\n", last);
+			exit();
+		}
+		exit();
+	}
+	wait();
+	for(i = fd; i <= last; i++)
+		if(close(i) < 0){
+			printf("fd: close %d failed\n", i);
+			exit();
+		}
+	if(close(last) != -1){
+		printf("fd: closed fd %d twice\n", last);
+		exit();
+	}
+	unlink("fdfile");
+	printf("fd test ok\n");
+}
+
+// Buffered output reaches the file by fflush() or exit(), and
+// fork() does not make the child write the parent's output again.
+void
+stdiotest(void)
+{
+	int fd, pid;
+	char s[8];
+
+	printf("stdio test\n");
+	unlink("stdiofile");
+	if((fd = open("stdiofile", O_CREATE|O_RDWR)) < 0){
+		printf("stdio: open failed\n");
+		exit();
+	}
+	if(fwrite(fd, "a", 1) != 1){
+		printf("stdio: fwrite failed\n");
+		exit();
+	}
+	pid = fork();
+	if(pid < 0){
+		printf("fork failed\n");
+		exit();
+	}
+	if(pid == 0){
+		fwrite(fd, "b", 1);
+		exit();
+	}
+	wait();
+	// close() writes out "c", and not to the next file with fd.
+	fwrite(fd, "c", 1);
+	if(close(fd) < 0 || open("stdiofile2", O_CREATE|O_RDWR) != fd){
+		printf("stdio: close or reopen failed\n");
+		exit();
+	}
+	close(fd);
+	fd = open("stdiofile", O_RDONLY);
+	memset(s, 0, sizeof(s));
+	if(read(fd, s, sizeof(s)) != 3 || strcmp(s, "abc") != 0){
+		printf("stdio: file has %s\n", s);
+		exit();
+	}
+	close(fd);
+	fd = open("stdiofile2", O_RDONLY);
+	if(read(fd, s, sizeof(s)) != 0){
+		printf("stdio: output went to the next file\n");
+		exit();
+	}
+	close(fd);
+	unlink("stdiofile");
+	unlink("stdiofile2");
+	printf("stdio test ok\n");
+}
+
+// Big writes through a pipe that grows to its full size,
+// read back in sizes that straddle its pages.
+void
+pipe2(void)
+{
+	int fds[2], pid;
+	int seq, i, n, total;
+
+	if(pipe(fds) != 0){
+		printf("pipe() failed\n");
+		exit();
+	}
+	pid = fork();
+	seq = 0;
+	if(pid == 0){
+		close(fds[0]);
+		for(n = 0; n < 8; n++){
+			for(i = 0; i < sizeof(buf); i++)
+				buf[i] = seq++;
+			if(write(fds[1], buf, sizeof(buf)) != sizeof(buf)){
+				printf("pipe2 oops 1\n");
+				exit();
+			}
+		}
+		exit();
+	} else if(pid > 0){
+		close(fds[1]);
+		total = 0;
+		while((n = read(fds[0], buf, 1000)) > 0){
+			for(i = 0; i < n; i++){
+				if((buf[i] & 0xff) != (seq++ & 0xff)){
+					printf("pipe2 oops 2\n");
+					exit();
+				}
+			}
+			total += n;
+		}
+		if(total != 8 * sizeof(buf)){
+			printf("pipe2 oops 3 total %d\n", total);
+			exit();
+		}
+		close(fds[0]);
+		wait();
+	} else {
+		printf("fork() failed\n");
+		exit();
+	}
+	printf("pipe2 ok\n");
+}
+
 // meant to be run w/ at most two CPUs
 void
 preempt(void)
@@ -1383,7 +1856,7 @@ forktest(void)
 
 	printf("fork test\n");
 
-	for(n=0; n<1000; n++){
+	for(n=0; n<NPROC; n++){
 		pid = fork();
 		if(pid < 0)
 			break;
@@ -1391,8 +1864,8 @@ forktest(void)
 			exit();
 	}
 
-	if(n == 1000){
-		printf("fork claimed to work 1000 times!\n");
+	if(n == NPROC){
+		printf("fork claimed to work %d times!\n", NPROC);
 		exit();
 	}
 
@@ -1737,6 +2210,518 @@ void argptest()
 	printf("arg test passed\n");
 }
 
+// mmap(): anonymous memory, private and shared file mappings,
+// munmap, and inheritance across fork.
+void
+mmaptest(void)
+{
+	int fd, i, pid;
+	char *p, *q;
+
+	printf("mmap test\n");
+
+	p = mmap(0, 3*4096, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if(p == MAP_FAILED){
+		printf("mmap anonymous failed\n");
+		exit();
+	}
+	for(i = 0; i < 3*4096; i++){
+		if(p[i] != 0){
+			printf("mmap anonymous not zeroed\n");
+			exit();
+		}
+		p[i] = i;
+	}
+	// A child gets its own copy.
+	pid = fork();
+	if(pid < 0){
+		printf("fork failed\n");
+		exit();
+	}
+	if(pid == 0){
+		for(i = 0; i < 3*4096; i++)
+			if(p[i] != (char)i){
+				printf("mmap not copied by fork\n");
+				exit();
+			}
+		p[0] = 'x';
+		exit();
+	}
+	wait();
+	if(p[0] != 0){
+		printf("mmap anonymous shared with child\n");
+		exit();
+	}
+	if(munmap(p, 3*4096) < 0){
+		printf("munmap failed\n");
+		exit();
+	}
+
+	fd = open("mmapfile", O_CREATE|O_RDWR);
+	if(fd < 0){
+		printf("create mmapfile failed\n");
+		exit();
+	}
+	for(i = 0; i < 2*4096; i++)
+		buf[i] = 'a' + i%26;
+	if(write(fd, buf, 2*4096) != 2*4096){
+		printf("write mmapfile failed\n");
+		exit();
+	}
+
+	// Private writes do not reach the file, or other mappings
+	// of it, whether the process or the kernel makes them.
+	p = mmap(0, 2*4096, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+	q = mmap(0, 2*4096, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(p == MAP_FAILED || q == MAP_FAILED){
+		printf("mmap private failed\n");
+		exit();
+	}
+	for(i = 0; i < 2*4096; i++)
+		if(p[i] != buf[i]){
+			printf("mmap private wrong contents\n");
+			exit();
+		}
+	p[0] = 'X';
+	if(pread(fd, p+4096, 1, 0) != 1 || p[4096] != 'a'){
+		printf("read into mmap private failed\n");
+		exit();
+	}
+	if(q[0] != 'a' || q[4096] != buf[4096]){
+		printf("mmap private write seen by another mapping\n");
+		exit();
+	}
+	munmap(p, 2*4096);
+	munmap(q, 2*4096);
+
+	// Shared writes, from parent and child, do.
+	p = mmap(0, 2*4096, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	q = mmap(0, 4096, PROT_READ, MAP_SHARED, fd, 4096);
+	if(p == MAP_FAILED || q == MAP_FAILED){
+		printf("mmap shared failed\n");
+		exit();
+	}
+	pid = fork();
+	if(pid < 0){
+		printf("fork failed\n");
+		exit();
+	}
+	if(pid == 0){
+		p[4096] = 'C';
+		exit();
+	}
+	wait();
+	if(q[0] != 'C'){
+		printf("mmap shared page not shared\n");
+		exit();
+	}
+	p[1] = 'P';
+	munmap(q, 4096);
+	munmap(p, 2*4096);
+	close(fd);
+
+	fd = open("mmapfile", O_RDONLY);
+	if(read(fd, buf, 2*4096) != 2*4096){
+		printf("read mmapfile failed\n");
+		exit();
+	}
+	close(fd);
+	if(buf[0] != 'a' || buf[1] != 'P' || buf[4096] != 'C'){
+		printf("mmap shared not written back\n");
+		exit();
+	}
+
+	// Bad arguments.
+	fd = open("mmapfile", O_RDONLY);
+	if(mmap(0, 4096, PROT_READ, MAP_SHARED|MAP_ANONYMOUS, -1, 0) != MAP_FAILED ||
+	   mmap(0, 4096, PROT_READ, MAP_SHARED, 100, 0) != MAP_FAILED ||
+	   mmap(0, 0xFFFFF001, PROT_READ, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0) != MAP_FAILED ||
+	   mmap(0, 4096, PROT_READ, MAP_PRIVATE, fd, -4096) != MAP_FAILED ||
+	   munmap((char*)0x40000000 + 1, 4096) >= 0 ||
+	   munmap((char*)0x40000000, 0xFFFFF001) >= 0){
+		printf("mmap bad arguments accepted\n");
+		exit();
+	}
+	close(fd);
+	unlink("mmapfile");
+	printf("mmap test ok\n");
+}
+
+// nice() returns the old value, is inherited by fork,
+// and rejects levels that do not exist.
+void
+nicetest(void)
+{
+	int pid;
+
+	printf("nice test\n");
+	if(nice(0, 2) != 0 || nice(getpid(), 1) != 2){
+		printf("nice: wrong old value\n");
+		exit();
+	}
+	pid = fork();
+	if(pid < 0){
+		printf("fork failed\n");
+		exit();
+	}
+	if(pid == 0){
+		if(nice(0, 0) != 1){
+			printf("nice: not inherited\n");
+			exit();
+		}
+		exit();
+	}
+	wait();
+	if(nice(0, -1) != -1 || nice(0, NPRIO) != -1 || nice(0, 0) != 1){
+		printf("nice: bad value accepted\n");
+		exit();
+	}
+	printf("nice test ok\n");
+}
+
+// wait() returns every child exactly once; kill() finds
+// processes by pid, and only those that exist.
+void
+childtest(void)
+{
+	int i, j, n, pid, pids[20];
+
+	printf("child test\n");
+	n = 0;
+	for(i = 0; i < sizeof(pids)/sizeof(pids[0]); i++){
+		if((pid = fork()) < 0)
+			break;
+		if(pid == 0){
+			sleep(1000);
+			exit();
+		}
+		pids[n++] = pid;
+	}
+	if(n == 0){
+		printf("fork failed\n");
+		exit();
+	}
+	for(i = 0; i < n; i++){
+		if(kill(pids[i]) < 0){
+			printf("kill %d failed\n", pids[i]);
+			exit();
+		}
+	}
+	for(i = 0; i < n; i++){
+		pid = wait();
+		for(j = 0; j < n; j++)
+			if(pid > 0 && pids[j] == pid)
+				break;
+		if(j == n){
+			printf("wait returned %d\n", pid);
+			exit();
+		}
+		pids[j] = 0;
+	}
+	if(wait() != -1 || kill(-1) != -1 || kill(0) != -1){
+		printf("child test: phantom process\n");
+		exit();
+	}
+	printf("child test ok\n");
+}
+
+// A process pinned to CPU 0 stays there.
+void
+affinitytest(void)
+{
+	struct pstat ps;
+	int i, old, pid;
+
+	printf("affinity test\n");
+	old = affinity(0, 0);
+	if((old & 1) == 0 || affinity(0, 1) != old){
+		printf("affinity: wrong old mask\n");
+		exit();
+	}
+	sleep(1);
+	if(getpstat(0, &ps) < 0 || ps.pid != getpid() || ps.affinity != 1 || ps.cpu != 0){
+		printf("affinity: not moved to cpu 0\n");
+		exit();
+	}
+	for(i = 0; i < 10; i++){
+		sleep(1);
+		if(getpstat(0, &ps) < 0 || ps.cpu != 0){
+			printf("affinity: ran on cpu %d\n", ps.cpu);
+			exit();
+		}
+	}
+	pid = fork();
+	if(pid < 0){
+		printf("fork failed\n");
+		exit();
+	}
+	if(pid == 0){
+		if(affinity(0, 0) != 1){
+			printf("affinity: not inherited\n");
+			exit();
+		}
+		exit();
+	}
+	wait();
+	if(affinity(0, 1 << 30) != -1 || affinity(-1, 1) != -1 ||
+	   getpstat(-1, &ps) != -1){
+		printf("affinity: bad argument accepted\n");
+		exit();
+	}
+	affinity(0, old);
+	printf("affinity test ok\n");
+}
+
+// sleep() and usleep() wait at least about as long as asked, and
+// usleep() not much longer.
+void
+sleeptest(void)
+{
+	int i, t0, t1;
+
+	printf("sleep test\n");
+	t0 = uptime();
+	if(sleep(5) < 0){
+		printf("sleep failed\n");
+		exit();
+	}
+	t1 = uptime();
+	if(t1 - t0 < 4){
+		printf("sleep(5) took %d ticks\n", t1 - t0);
+		exit();
+	}
+	// 20 sleeps of half a millisecond take about one tick,
+	// not one or two ticks each.
+	t0 = uptime();
+	for(i = 0; i < 20; i++)
+		if(usleep(500) < 0){
+			printf("usleep failed\n");
+			exit();
+		}
+	t1 = uptime();
+	if(t1 - t0 >= 10){
+		printf("20 x usleep(500) took %d ticks\n", t1 - t0);
+		exit();
+	}
+	t0 = uptime();
+	if(usleep(50000) < 0){
+		printf("usleep failed\n");
+		exit();
+	}
+	t1 = uptime();
+	if(t1 - t0 < 4){
+		printf("usleep(50 ms) took %d ticks\n", t1 - t0);
+		exit();
+	}
+	printf("sleep test ok\n");
+}
+
+// Threads share memory and open files, each has its own stack,
+// and join() reaps them.
+#define NTHREADS 4
+volatile int tcount[NTHREADS];
+int tfd;
+
+void
+threadfn(void *arg)
+{
+	int i, id = (int)arg;
+
+	for(i = 0; i < 100000; i++)
+		tcount[id]++;
+	if(id == 0 && write(tfd, "t", 1) != 1)
+		tcount[id] = -1;
+}
+
+void
+threadtest(void)
+{
+	int i, tid[NTHREADS];
+	char c;
+
+	printf("thread test\n");
+	unlink("threadfile");
+	if((tfd = open("threadfile", O_CREATE|O_RDWR)) < 0){
+		printf("create threadfile failed\n");
+		exit();
+	}
+	for(i = 0; i < NTHREADS; i++){
+		if((tid[i] = thread_create(threadfn, (void*)i)) < 0){
+			printf("thread_create failed\n");
+			exit();
+		}
+	}
+	if(wait() != -1){
+		printf("wait returned a thread\n");
+		exit();
+	}
+	for(i = 0; i < NTHREADS; i++){
+		if(thread_join(tid[i]) != tid[i]){
+			printf("thread_join failed\n");
+			exit();
+		}
+		if(tcount[i] != 100000){
+			printf("thread %d counted %d\n", i, tcount[i]);
+			exit();
+		}
+	}
+	if(thread_join(0) != -1){
+		printf("thread_join without threads\n");
+		exit();
+	}
+	close(tfd);
+	tfd = open("threadfile", O_RDONLY);
+	if(read(tfd, &c, 1) != 1 || c != 't'){
+		printf("thread did not share fd\n");
+		exit();
+	}
+	close(tfd);
+	unlink("threadfile");
+	printf("thread test ok\n");
+}
+
+// System calls whose buffer another thread unmaps meanwhile
+// fail, or stop short, instead of crashing the kernel.
+volatile int unmapdone;
+char *unmapbuf;
+
+void
+unmapfn(void *arg)
+{
+	int i;
+
+	for(i = 0; i < 1000; i++){
+		munmap(unmapbuf, 4096);
+		if(mmap(0, 4096, PROT_READ|PROT_WRITE,
+		        MAP_PRIVATE|MAP_ANONYMOUS, -1, 0) != unmapbuf){
+			unmapdone = -1;
+			return;
+		}
+	}
+	unmapdone = 1;
+}
+
+void
+unmaptest(void)
+{
+	int fd, fds[2], tid, n;
+
+	printf("unmap test\n");
+	fd = open("unmapfile", O_CREATE|O_RDWR);
+	if(fd < 0 || write(fd, buf, 4096) != 4096){
+		printf("create unmapfile failed\n");
+		exit();
+	}
+	if(pipe(fds) != 0){
+		printf("pipe() failed\n");
+		exit();
+	}
+	unmapbuf = mmap(0, 4096, PROT_READ|PROT_WRITE,
+	                MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if(unmapbuf == MAP_FAILED){
+		printf("mmap failed\n");
+		exit();
+	}
+	unmapdone = 0;
+	if((tid = thread_create(unmapfn, 0)) < 0){
+		printf("thread_create failed\n");
+		exit();
+	}
+	while(unmapdone == 0){
+		n = pread(fd, unmapbuf, 4096, 0);
+		if(n != 4096 && n != -1){
+			printf("pread into unmapped buffer returned %d\n", n);
+			exit();
+		}
+		if(write(fds[1], buf, 512) != 512){
+			printf("write to pipe failed\n");
+			exit();
+		}
+		if((n = read(fds[0], unmapbuf, 512)) < 0)
+			n = 0;
+		if(n < 512 && read(fds[0], buf, 512 - n) != 512 - n){
+			printf("pipe lost data\n");
+			exit();
+		}
+	}
+	if(thread_join(tid) != tid || unmapdone != 1){
+		printf("unmap thread failed\n");
+		exit();
+	}
+	munmap(unmapbuf, 4096);
+	close(fds[0]);
+	close(fds[1]);
+	close(fd);
+	unlink("unmapfile");
+	printf("unmap test ok\n");
+}
+
+struct mutex fmu;
+struct cond fcv;
+int fcount, fturn;
+
+void
+futexfn(void *arg)
+{
+	int i;
+
+	for(i = 0; i < 10000; i++){
+		mutex_lock(&fmu);
+		fcount++;
+		mutex_unlock(&fmu);
+	}
+	// Take turns with the other threads, in thread order.
+	mutex_lock(&fmu);
+	while(fturn != (int)arg)
+		cond_wait(&fcv, &fmu);
+	fturn++;
+	cond_broadcast(&fcv);
+	mutex_unlock(&fmu);
+}
+
+void
+futextest(void)
+{
+	int i, tid[NTHREADS];
+	volatile int word;
+
+	printf("futex test\n");
+	word = 1;
+	if(futex(&word, FUTEX_WAIT, 0) != -1){
+		printf("futex waited on a changed word\n");
+		exit();
+	}
+	if(futex(&word, FUTEX_WAKE, 1) != 0){
+		printf("futex woke a waiter that does not exist\n");
+		exit();
+	}
+	if(futex((int*)((char*)&word + 1), FUTEX_WAKE, 1) != -1){
+		printf("futex accepted a misaligned word\n");
+		exit();
+	}
+
+	mutex_init(&fmu);
+	cond_init(&fcv);
+	fcount = fturn = 0;
+	for(i = 0; i < NTHREADS; i++){
+		if((tid[i] = thread_create(futexfn, (void*)(NTHREADS-1-i))) < 0){
+			printf("thread_create failed\n");
+			exit();
+		}
+	}
+	for(i = 0; i < NTHREADS; i++){
+		if(thread_join(tid[i]) != tid[i]){
+			printf("thread_join failed\n");
+			exit();
+		}
+	}
+	if(fcount != NTHREADS*10000 || fturn != NTHREADS){
+		printf("futex mutex lost updates: %d %d\n", fcount, fturn);
+		exit();
+	}
+	printf("futex test ok\n");
+}
+
 unsigned long randstate = 1;
 unsigned int
 rand()
@@ -1781,6 +2766,14 @@ main(int argc, char *argv[])
 
 	mem();
 	pipe1();
+	pipe2();
+	splicetest();
+	iovtest();
+	stdiotest();
+	seektest();
+	fdtest();
+	polltest();
+	nonblocktest();
 	preempt();
 	exitwait();
 
@@ -1793,6 +2786,14 @@ main(int argc, char *argv[])
 	dirfile();
 	iref();
 	forktest();
+	mmaptest();
+	nicetest();
+	affinitytest();
+	childtest();
+	sleeptest();
+	threadtest();
+	unmaptest();
+	futextest();
 	bigdir(); // slow
 
 	uio();
@@ -0,0 +1,56 @@
+// User-level threads on top of clone() and join().
+
+#include "kernel/types.h"
+#include "user.h"
+
+#define TSTACKSIZE 8192
+
+// What a new thread runs, kept at the top of its stack.
+struct tstart {
+	void (*fn)(void*);
+	void *arg;
+};
+
+static void
+threadstart(void *a)
+{
+	struct tstart *t = a;
+
+	t->fn(t->arg);
+	// Not exit(): its fflush(-1) would race with the other threads
+	// on their buffered output.
+	_exit();
+}
+
+// Run fn(arg) in a new thread with its own TSTACKSIZE stack.
+// Returns the thread id for thread_join(), or -1.
+// Uses malloc(), so only one thread should create and join.
+int
+thread_create(void (*fn)(void*), void *arg)
+{
+	char *stack;
+	struct tstart *t;
+	int tid;
+
+	if((stack = malloc(TSTACKSIZE)) == 0)
+		return -1;
+	t = (struct tstart*)(stack + TSTACKSIZE) - 1;
+	t->fn = fn;
+	t->arg = arg;
+	if((tid = clone(threadstart, t, t)) < 0)
+		free(stack);
+	return tid;
+}
+
+// Wait for thread tid (any thread if 0) to finish and free its
+// stack. Returns its id, or -1.
+int
+thread_join(int tid)
+{
+	void *top;
+
+	if((tid = join(tid, &top)) < 0)
+		return -1;
+	free((char*)top + sizeof(struct tstart) - TSTACKSIZE);
+	return tid;
+}